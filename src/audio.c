@@ -1,19 +1,84 @@
+#include <math.h>
+
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/timestamp.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+#include <libavutil/avstring.h>
+#include <libavfilter/avfiltergraph.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libswresample/swresample.h>
 
 #include <SDL2/SDL.h>
 
+#include "internal.h"
 #include "debug.h"
 #include "pktq.h"
+#include "ringbuf.h"
+#include "sched.h"
+#include "clock.h"
+#include "bench.h"
+#include "stats.h"
+#include "export.h"
+#include "live.h"
 #include "audio.h"
 
-static int audio_stream_idx = -1;
-static AVStream *audio_stream = NULL;
-static AVCodecContext *audio_dec_ctx = NULL;
-static AVFrame *frame_audio = NULL;
-static int audio_frame_count = 0;
-static PacketQueue audio_queue = PACKET_QUEUE_INITIALIZER;
+typedef struct AudioParams {
+	int freq;
+	int channels;
+	int64_t channel_layout;
+	enum AVSampleFormat fmt;
+	int bytes_per_sec;
+} AudioParams;
+
+struct AudioState {
+	int audio_stream_idx;		// the demuxer's, the decoder follows on the next flush
+	AVStream *audio_stream;		// the decoder's
+	AVCodecContext *audio_dec_ctx;
+	AVFrame *frame_audio;
+	int audio_frame_count;
+	PacketQueue audio_queue;
+	Task *audio_task;
+	SDL_AudioDeviceID audio_dev;	// 0 without a device, in the headless modes
+	SDL_AudioSpec audio_spec;
+
+	AudioParams audio_src;	// what the decoder gives us
+	AudioParams audio_tgt;	// what the device plays
+	struct SwrContext *swr_ctx;
+	uint8_t *audio_buf;	// converted samples on their way to the ring
+	unsigned int audio_buf_size;
+	uint8_t *audio_pending;	// converted samples that did not fit the ring yet
+	unsigned int audio_pending_size;
+	int audio_pending_len;
+	double audio_pending_clock;	// pts right after the pending samples
+	double audio_pending_speed;
+
+	AVFilterContext *abuffersink_ctx;
+	AVFilterContext *abuffersrc_ctx;
+	AVFilterGraph *afilter_graph;
+	char afilter_user[512];		// --audio-filter, empty if none
+	AudioParams afilter_src;	// what the graph was configured for
+	double afilter_speed;		// the atempo the graph was configured for
+	double afilter_pts;		// media time of the next sample out of the graph
+	SDL_atomic_t audio_speed;	// requested speed, in percent
+	AVFrame *frame_filtered;
+
+	/* converted samples ready for the device, the callback only copies out of it */
+	RingBuffer audio_ring;
+
+	SDL_SpinLock audio_clock_lock;
+	double audio_write_clock;	// pts at audio_write_pos, in seconds
+	double audio_write_speed;	// media seconds per second of the ring
+	unsigned audio_write_pos;	// bytes written to the ring so far
+	unsigned audio_read_pos;	// bytes played out of the ring so far
+	int audio_serial;		// serial of the packets the ring is filled from
+	double audio_flush_target;	// seek target of the last flush
+	double audio_seek_target;	// samples before this are decoded but not played
+	int audio_finished;		// serial the decoder was drained at
+	int audio_finishing;		// drained, the pending samples go first
+};
 
 static SDL_AudioFormat get_format(enum AVSampleFormat sample_fmt)
 {
@@ -47,50 +112,571 @@ static SDL_AudioFormat get_format(enum AVSampleFormat sample_fmt)
     return fmt;
 }
 
+static enum AVSampleFormat get_sample_fmt(SDL_AudioFormat fmt)
+{
+	switch (fmt) {
+	case AUDIO_U8:
+		return AV_SAMPLE_FMT_U8;
+	case AUDIO_S16SYS:
+		return AV_SAMPLE_FMT_S16;
+	case AUDIO_S32SYS:
+		return AV_SAMPLE_FMT_S32;
+	case AUDIO_F32SYS:
+		return AV_SAMPLE_FMT_FLT;
+	default:
+		return AV_SAMPLE_FMT_NONE;
+	}
+}
+
 static void audio_proc(void *userdata, Uint8 *stream, int len)
 {
-	SDL_AudioSpec *spec = (SDL_AudioSpec *)userdata;
+	Player *p = userdata;
+	AudioState *as = p->audio;
+	SDL_AudioSpec *spec = &as->audio_spec;
+	double callback_time = clock_time();
+	double clock = NAN, speed = 1.0;
+
+	// still filled from before a seek, never play that
+	if (as->audio_serial != packet_queue_serial(&as->audio_queue)) {
+		ring_buffer_flush(&as->audio_ring);
+		SDL_memset(stream, spec->silence, len);
+		return;
+	}
 
-	unsigned int *size = &frame_audio->linesize[0];
-	unsigned int *pos = &frame_audio->linesize[1];	// we use this to store pos info
+	// samples are already in the device format, just copy them out
+	unsigned copied = ring_buffer_read(&as->audio_ring, stream, len);
+	if (copied < len) {
+		SDL_memset(stream + copied, spec->silence, len - copied);
 
-	SDL_memset(stream, 0, len);
+		/* ran dry after we started playing, and not because the file ended */
+		if (as->audio_read_pos && as->audio_finished != as->audio_serial)
+			stats_count(p, STATS_AUDIO_UNDERRUNS);
+	}
 
-	while (len > 0){
-		if (*pos >= *size) { //already send all our data, get more
-			AVPacket audio_pkt;
-			if (audio_dequeue(&audio_pkt)) {
-				decode_audio_packet(&audio_pkt);
-			} else {
-				break;
-			}
-			*pos = 0;
+	SDL_AtomicLock(&as->audio_clock_lock);
+	as->audio_read_pos += copied;
+	if (!isnan(as->audio_write_clock)) {
+		clock = as->audio_write_clock - (double)(as->audio_write_pos - as->audio_read_pos) /
+			as->audio_tgt.bytes_per_sec * as->audio_write_speed;
+	}
+	speed = as->audio_write_speed;
+	SDL_AtomicUnlock(&as->audio_clock_lock);
+
+	/* what is audible right now lags behind what we just wrote by the
+	 * data SDL still holds, assume it double buffers like most backends */
+	if (!isnan(clock)) {
+		double latency = (double)(2 * spec->size) / as->audio_tgt.bytes_per_sec * speed;
+
+		clock_set_at(sync_clock(p, AV_SYNC_AUDIO_MASTER), clock - latency, callback_time);
+		clock_sync_to_slave(sync_clock(p, AV_SYNC_EXTERNAL_CLOCK), sync_clock(p, AV_SYNC_AUDIO_MASTER));
+	}
+}
+
+/* convert a decoded frame to the device format, returns the size in bytes */
+static int audio_convert(Player *p, AVFrame *frame, const uint8_t **out)
+{
+	AudioState *as = p->audio;
+	int channels = av_frame_get_channels(frame);
+	int64_t channel_layout = (frame->channel_layout &&
+		av_get_channel_layout_nb_channels(frame->channel_layout) == channels) ?
+		frame->channel_layout : av_get_default_channel_layout(channels);
+
+	/* already what the device wants, skip the resampler */
+	if (frame->format == as->audio_tgt.fmt && channels == as->audio_tgt.channels &&
+		frame->sample_rate == as->audio_tgt.freq) {
+		*out = frame->data[0];
+		return av_samples_get_buffer_size(NULL, channels, frame->nb_samples, frame->format, 1);
+	}
+
+	if (!as->swr_ctx || frame->format != as->audio_src.fmt || channel_layout != as->audio_src.channel_layout ||
+		frame->sample_rate != as->audio_src.freq) {
+		swr_free(&as->swr_ctx);
+		as->swr_ctx = swr_alloc_set_opts(NULL,
+			as->audio_tgt.channel_layout, as->audio_tgt.fmt, as->audio_tgt.freq,
+			channel_layout, frame->format, frame->sample_rate,
+			0, NULL);
+		if (!as->swr_ctx || swr_init(as->swr_ctx) < 0) {
+			fprintf(stderr, "Cannot create sample rate converter for conversion of %d Hz %s %d channels to %d Hz %s %d channels!\n",
+				frame->sample_rate, av_get_sample_fmt_name(frame->format), channels,
+				as->audio_tgt.freq, av_get_sample_fmt_name(as->audio_tgt.fmt), as->audio_tgt.channels);
+			swr_free(&as->swr_ctx);
+			return -1;
 		}
 
-		int my_len = (*size > 0 ? *size : 0) - *pos;
-		if (my_len > len) {
-			my_len = len;
+		as->audio_src.channel_layout = channel_layout;
+		as->audio_src.channels = channels;
+		as->audio_src.freq = frame->sample_rate;
+		as->audio_src.fmt = frame->format;
+	}
+
+	int out_count = (int64_t)frame->nb_samples * as->audio_tgt.freq / frame->sample_rate + 256;
+	int out_size = av_samples_get_buffer_size(NULL, as->audio_tgt.channels, out_count, as->audio_tgt.fmt, 0);
+	if (out_size < 0) {
+		return out_size;
+	}
+
+	av_fast_malloc(&as->audio_buf, &as->audio_buf_size, out_size);
+	if (!as->audio_buf) {
+		return AVERROR(ENOMEM);
+	}
+
+	int64_t begin = stats_begin();
+	int len = swr_convert(as->swr_ctx, &as->audio_buf, out_count,
+		(const uint8_t **)frame->extended_data, frame->nb_samples);
+	stats_end(p, STATS_AUDIO_CONVERT, begin);
+	if (len < 0) {
+		fprintf(stderr, "swr_convert() failed\n");
+		return len;
+	}
+
+	*out = as->audio_buf;
+	return len * as->audio_tgt.channels * av_get_bytes_per_sample(as->audio_tgt.fmt);
+}
+
+/*
+ * abuffer -> user chain -> abuffersink, with the sink negotiated down to
+ * the device format, rate and layout, so whatever the chain does, the
+ * resampling for the device happens in the same pass and the frames go
+ * into the ring without swresample.
+ */
+static int init_audio_filter_graph(Player *p, const char *filters_descr, const AudioParams *src)
+{
+    AudioState *as = p->audio;
+    char args[512];
+    int ret = 0;
+    AVFilter *abuffersrc  = avfilter_get_by_name("abuffer");
+    AVFilter *abuffersink = avfilter_get_by_name("abuffersink");
+    AVFilterInOut *outputs = avfilter_inout_alloc();
+    AVFilterInOut *inputs  = avfilter_inout_alloc();
+    AVRational time_base = as->audio_stream->time_base;
+    const enum AVSampleFormat sample_fmts[] = { as->audio_tgt.fmt, AV_SAMPLE_FMT_NONE };
+    const int64_t channel_layouts[] = { as->audio_tgt.channel_layout, -1 };
+    const int sample_rates[] = { as->audio_tgt.freq, -1 };
+
+    as->afilter_graph = avfilter_graph_alloc();
+    if (!outputs || !inputs || !as->afilter_graph) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+
+    /* buffer audio source: the decoded frames from the decoder will be inserted here. */
+    snprintf(args, sizeof(args),
+            "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%"PRIx64,
+            time_base.num, time_base.den, src->freq,
+            av_get_sample_fmt_name(src->fmt), src->channel_layout);
+
+    ret = avfilter_graph_create_filter(&as->abuffersrc_ctx, abuffersrc, "in",
+                                       args, NULL, as->afilter_graph);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot create audio buffer source\n");
+        goto end;
+    }
+
+    /* buffer audio sink: to terminate the filter chain. */
+    ret = avfilter_graph_create_filter(&as->abuffersink_ctx, abuffersink, "out",
+                                       NULL, NULL, as->afilter_graph);
+    if (ret < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot create audio buffer sink\n");
+        goto end;
+    }
+
+    if ((ret = av_opt_set_int_list(as->abuffersink_ctx, "sample_fmts", sample_fmts,
+                                   AV_SAMPLE_FMT_NONE, AV_OPT_SEARCH_CHILDREN)) < 0 ||
+        (ret = av_opt_set_int_list(as->abuffersink_ctx, "channel_layouts", channel_layouts,
+                                   -1, AV_OPT_SEARCH_CHILDREN)) < 0 ||
+        (ret = av_opt_set_int_list(as->abuffersink_ctx, "sample_rates", sample_rates,
+                                   -1, AV_OPT_SEARCH_CHILDREN)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot set the device format on the audio buffer sink\n");
+        goto end;
+    }
+
+    outputs->name       = av_strdup("in");
+    outputs->filter_ctx = as->abuffersrc_ctx;
+    outputs->pad_idx    = 0;
+    outputs->next       = NULL;
+
+    inputs->name       = av_strdup("out");
+    inputs->filter_ctx = as->abuffersink_ctx;
+    inputs->pad_idx    = 0;
+    inputs->next       = NULL;
+
+    if ((ret = avfilter_graph_parse_ptr(as->afilter_graph, filters_descr,
+                                    &inputs, &outputs, NULL)) < 0)
+        goto end;
+
+    if ((ret = avfilter_graph_config(as->afilter_graph, NULL)) < 0)
+        goto end;
+
+    as->afilter_src = *src;
+
+end:
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+
+    return ret;
+}
+
+static double audio_requested_speed(Player *p)
+{
+	return SDL_AtomicGet(&p->audio->audio_speed) / 100.0;
+}
+
+/*
+ * Rebuild the graph for src at speed, on a seek, a speed change or when
+ * the decoder output changes. With no user filter at 1x there is no graph.
+ */
+static int audio_reconfigure_filters(Player *p, const AudioParams *src, double speed)
+{
+	AudioState *as = p->audio;
+	char descr[sizeof(as->afilter_user) + 64];
+	double tempo = speed;
+	int ret = 0;
+
+	avfilter_graph_free(&as->afilter_graph);
+	as->afilter_src = *src;
+	as->afilter_speed = speed;
+	as->afilter_pts = NAN;
+
+	if (!as->afilter_user[0] && speed == 1.0)
+		return 0;
+
+	/* atempo only stretches between 0.5x and 2x, chain it for the rest */
+	av_strlcpy(descr, as->afilter_user[0] ? as->afilter_user : "anull", sizeof(descr));
+	for (; tempo > 2.0; tempo /= 2.0)
+		av_strlcat(descr, ",atempo=2.0", sizeof(descr));
+	for (; tempo < 0.5; tempo /= 0.5)
+		av_strlcat(descr, ",atempo=0.5", sizeof(descr));
+	if (tempo != 1.0)
+		av_strlcatf(descr, sizeof(descr), ",atempo=%f", tempo);
+
+	if ((ret = init_audio_filter_graph(p, descr, src)) < 0) {
+		fprintf(stderr, "Could not configure the audio filters (%s)\n", av_err2str(ret));
+		avfilter_graph_free(&as->afilter_graph);
+	}
+
+	return ret;
+}
+
+/*
+ * Without a user filter and at 1x frames only go through swresample, and
+ * only when the device does not take them as they are, as before. Call
+ * after sdl_audio_init, the graph ends in the device format.
+ */
+int init_audio_filters(Player *p, const char *af)
+{
+	AudioState *as = p->audio;
+	AudioParams src;
+
+	as->frame_filtered = av_frame_alloc();
+	if (!as->frame_filtered)
+		return AVERROR(ENOMEM);
+
+	src.freq = as->audio_dec_ctx->sample_rate;
+	src.channels = as->audio_dec_ctx->channels;
+	src.channel_layout = (as->audio_dec_ctx->channel_layout &&
+		av_get_channel_layout_nb_channels(as->audio_dec_ctx->channel_layout) == src.channels) ?
+		as->audio_dec_ctx->channel_layout : av_get_default_channel_layout(src.channels);
+	src.fmt = as->audio_dec_ctx->sample_fmt;
+
+	av_strlcpy(as->afilter_user, af ? af : "", sizeof(as->afilter_user));
+	if (!af)
+		debug_info("no audio filter, bypassing the filter graph at 1x\n");
+
+	return audio_reconfigure_filters(p, &src, audio_requested_speed(p));
+}
+
+/* copy as much as the ring takes right now, returns how much that was */
+static int audio_ring_write(Player *p, const uint8_t *buf, int len, double end_clock, double speed)
+{
+	AudioState *as = p->audio;
+	int chunk = FFMIN(len, ring_buffer_space(&as->audio_ring));
+
+	if (chunk <= 0)
+		return 0;
+
+	ring_buffer_copy_in(&as->audio_ring, buf, chunk);
+
+	/* account before commit, so the callback never reads bytes we did not count */
+	SDL_AtomicLock(&as->audio_clock_lock);
+	as->audio_write_pos += chunk;
+	as->audio_write_clock = end_clock - (double)(len - chunk) / as->audio_tgt.bytes_per_sec * speed;
+	as->audio_write_speed = speed;
+	SDL_AtomicUnlock(&as->audio_clock_lock);
+
+	ring_buffer_commit(&as->audio_ring, chunk);
+	return chunk;
+}
+
+/* push converted samples into the ring, end_clock is the pts right after them,
+ * every second of samples covers speed seconds of the stream; what does not
+ * fit waits in audio_pending, the decoder does not block on the device */
+static int audio_write(Player *p, const uint8_t *buf, int len, double end_clock, double speed)
+{
+	AudioState *as = p->audio;
+
+	if (!as->audio_pending_len) {
+		int written = audio_ring_write(p, buf, len, end_clock, speed);
+		buf += written;
+		len -= written;
+	}
+
+	if (len > 0) {
+		uint8_t *pending = av_fast_realloc(as->audio_pending, &as->audio_pending_size,
+			as->audio_pending_len + len);
+		if (!pending)
+			return AVERROR(ENOMEM);
+		memcpy(pending + as->audio_pending_len, buf, len);
+		as->audio_pending = pending;
+		as->audio_pending_len += len;
+		as->audio_pending_clock = end_clock;
+		as->audio_pending_speed = speed;
+	}
+
+	return 0;
+}
+
+/* returns 1 once nothing is pending any more */
+static int audio_write_pending(Player *p)
+{
+	AudioState *as = p->audio;
+	int written = audio_ring_write(p, as->audio_pending, as->audio_pending_len,
+		as->audio_pending_clock, as->audio_pending_speed);
+
+	as->audio_pending_len -= written;
+	if (as->audio_pending_len)
+		memmove(as->audio_pending, as->audio_pending + written, as->audio_pending_len);
+
+	return !as->audio_pending_len;
+}
+
+/* the demuxer switched tracks, the device and the ring stay, only the decoder changes */
+static void audio_switch_decoder(Player *p)
+{
+	AudioState *as = p->audio;
+	AVStream *st = p->fmt_ctx->streams[as->audio_stream_idx];
+
+	/* opened here, player_select_track may be asked again before we get to it */
+	if (!avcodec_is_open(st->codec) && open_stream_codec(p, st) < 0) {
+		fprintf(stderr, "Could not switch to audio track %d, staying on %d\n",
+			st->index, as->audio_stream->index);
+		demux_request_track(p, as->audio_stream->index);
+		return;
+	}
+
+	avcodec_close(as->audio_dec_ctx);
+	as->audio_stream = st;
+	as->audio_dec_ctx = st->codec;
+}
+
+/* the packets now come from somewhere else, forget everything decoded so far */
+static void audio_decoder_flush(Player *p, int serial)
+{
+	AudioState *as = p->audio;
+
+	if (as->audio_stream->index != as->audio_stream_idx)
+		audio_switch_decoder(p);
+
+	avcodec_flush_buffers(as->audio_dec_ctx);
+	swr_free(&as->swr_ctx);
+
+	/* the graph may still hold samples from before the seek */
+	if (as->afilter_graph)
+		audio_reconfigure_filters(p, &as->afilter_src, as->afilter_speed);
+
+	/* keep the callback out while the ring and its accounting restart */
+	SDL_LockAudioDevice(as->audio_dev);
+	ring_buffer_flush(&as->audio_ring);
+	as->audio_write_pos = 0;
+	as->audio_read_pos = 0;
+	as->audio_write_clock = NAN;
+	as->audio_serial = serial;
+	SDL_UnlockAudioDevice(as->audio_dev);
+
+	as->audio_pending_len = 0;
+	as->audio_finishing = 0;
+	as->audio_seek_target = as->audio_flush_target;
+}
+
+static int decode_audio(Player *p, AVPacket *pkt, int *got_frame);
+static int filter_audio(Player *p, AVFrame *frame);
+
+/*
+ * Decode one packet into the ring per step. The samples that did not fit
+ * go first on the next step, which waits for the device to make room.
+ */
+static int audio_decode_step(void *opaque)
+{
+	Player *p = opaque;
+	AudioState *as = p->audio;
+	AVPacket audio_pkt;
+	int serial = 0, got_frame = 0;
+
+	if (packet_queue_aborted(&as->audio_queue))
+		return TASK_DONE;
+
+	if (as->audio_pending_len) {
+		/* seeked away, the rest is stale */
+		if (as->audio_serial != packet_queue_serial(&as->audio_queue))
+			as->audio_pending_len = 0;
+		else if (!audio_write_pending(p))
+			return TASK_WAIT;
+	}
+
+	if (as->audio_finishing) {
+		as->audio_finishing = 0;
+		as->audio_finished = as->audio_serial;
+	}
+
+	if (!packet_queue_get(&as->audio_queue, &audio_pkt, 0, &serial))
+		return TASK_WAIT;
+
+	AVPacket orig_pkt = audio_pkt;
+
+	if (serial != as->audio_serial)
+		audio_decoder_flush(p, serial);
+
+	if (!audio_pkt.data) {
+		/* end of file, get the delayed frames out of the decoder */
+		do {
+			if (decode_audio(p, &audio_pkt, &got_frame) < 0)
+				break;
+		} while (got_frame);
+		/* and the samples the filters still hold, atempo keeps a window */
+		if (as->afilter_graph)
+			filter_audio(p, NULL);
+		as->audio_finishing = 1;
+		return TASK_AGAIN;
+	}
+
+	do {
+		int ret = decode_audio(p, &audio_pkt, &got_frame);
+		if (ret <= 0)
+			break;
+		audio_pkt.data += ret;
+		audio_pkt.size -= ret;
+	} while (audio_pkt.size > 0);
+
+	av_packet_unref(&orig_pkt);
+
+	return TASK_AGAIN;
+}
+
+/* convert a decoded or filtered frame and write it to the ring, pts in seconds
+ * of the stream, speed is how much of the stream a second of the frame covers */
+static int audio_queue_frame(Player *p, AVFrame *frame, double pts, double speed)
+{
+	AudioState *as = p->audio;
+	const uint8_t *buf = NULL;
+	int size = audio_convert(p, frame, &buf);
+	if (size < 0)
+		return size;
+
+	/* keep counting from the previous frame if this one has no pts */
+	double duration = (double)frame->nb_samples / frame->sample_rate * speed;
+	double last_clock = as->audio_pending_len ? as->audio_pending_clock : as->audio_write_clock;
+	double end_clock = isnan(pts) ? last_clock + duration : pts + duration;
+
+	/* decode up to the seek target, cut the frame that straddles it */
+	if (!isnan(as->audio_seek_target)) {
+		double skip = as->audio_seek_target - (end_clock - duration);
+		if (skip >= duration)
+			return 0;
+		if (skip > 0) {
+			int frame_size = as->audio_tgt.channels * av_get_bytes_per_sample(as->audio_tgt.fmt);
+			int skip_size = FFMIN((int)(skip / speed * as->audio_tgt.bytes_per_sec) / frame_size * frame_size, size);
+			buf += skip_size;
+			size -= skip_size;
 		}
+		as->audio_seek_target = NAN;
+	}
+
+	return audio_write(p, buf, size, end_clock, speed);
+}
 
-		Uint8 *buf = frame_audio->extended_data[0];		
-		SDL_MixAudioFormat(stream, &buf[*pos], AUDIO_S16SYS, len, SDL_MIX_MAXVOLUME);
+/* push frame through the graph, NULL at the end of the stream, and queue what comes out */
+static int filter_audio(Player *p, AVFrame *frame)
+{
+	AudioState *as = p->audio;
+	int64_t begin = 0;
+	int ret = 0;
+
+	/* atempo restarts its timestamps, count the output from the first input instead */
+	if (frame && isnan(as->afilter_pts) && frame->pts != AV_NOPTS_VALUE)
+		as->afilter_pts = frame->pts * av_q2d(as->audio_stream->time_base);
+
+	begin = stats_begin();
+	ret = av_buffersrc_add_frame(as->abuffersrc_ctx, frame);
+	stats_end(p, STATS_AUDIO_FILTER, begin);
+	if (ret < 0) {
+		av_log(NULL, AV_LOG_ERROR, "Error while feeding the audio filtergraph\n");
+		return ret;
+	}
 
-		len -= my_len;
-		stream += my_len;
-		*pos += my_len;
+	while (1) {
+		begin = stats_begin();
+		ret = av_buffersink_get_frame(as->abuffersink_ctx, as->frame_filtered);
+		stats_end(p, STATS_AUDIO_FILTER, begin);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+			break;
+		if (ret < 0)
+			return ret;
+
+		stats_add_frames(p, STATS_AUDIO_FILTER, 1);
+		double pts = as->afilter_pts;
+		if (!isnan(as->afilter_pts))
+			as->afilter_pts += (double)as->frame_filtered->nb_samples / as->frame_filtered->sample_rate * as->afilter_speed;
+
+		ret = audio_queue_frame(p, as->frame_filtered, pts, as->afilter_speed);
+		av_frame_unref(as->frame_filtered);
+		if (ret < 0)
+			return ret;
 	}
+
+	return 0;
 }
 
-int decode_audio_packet(AVPacket *pkt)
+/* the graph follows the decoder output and the requested speed */
+static int audio_follow_frame(Player *p, AVFrame *frame)
 {
+	AudioState *as = p->audio;
+	int channels = av_frame_get_channels(frame);
+	int64_t channel_layout = (frame->channel_layout &&
+		av_get_channel_layout_nb_channels(frame->channel_layout) == channels) ?
+		frame->channel_layout : av_get_default_channel_layout(channels);
+	double speed = audio_requested_speed(p);
+
+	frame->channel_layout = channel_layout;
+
+	if (speed != as->afilter_speed || (as->afilter_graph && (frame->format != as->afilter_src.fmt ||
+		frame->sample_rate != as->afilter_src.freq || channel_layout != as->afilter_src.channel_layout))) {
+		AudioParams src = { frame->sample_rate, channels, channel_layout, frame->format, 0 };
+		return audio_reconfigure_filters(p, &src, speed);
+	}
+
+	return 0;
+}
+
+int decode_audio_packet(Player *p, AVPacket *pkt)
+{
+	int got_frame = 0;
+
+	return decode_audio(p, pkt, &got_frame);
+}
+
+static int decode_audio(Player *p, AVPacket *pkt, int *got_frame)
+{
+    AudioState *as = p->audio;
     int ret = 0;
     int decoded = pkt->size;
+    int64_t begin = 0;
 
-    int _got_frame = 0, *got_frame = &_got_frame;
+    *got_frame = 0;
 
-    if (pkt->stream_index == audio_stream_idx) {
+    if (pkt->stream_index == as->audio_stream->index) {
         /* decode audio frame */
-        ret = avcodec_decode_audio4(audio_dec_ctx, frame_audio, got_frame, pkt);
+        begin = stats_begin();
+        ret = avcodec_decode_audio4(as->audio_dec_ctx, as->frame_audio, got_frame, pkt);
+        stats_end(p, STATS_AUDIO_DECODE, begin);
         if (ret < 0) {
             fprintf(stderr, "Error decoding audio frame (%s)\n", av_err2str(ret));
             return ret;
@@ -102,107 +688,316 @@ int decode_audio_packet(AVPacket *pkt)
         decoded = FFMIN(ret, pkt->size);
 
         if (*got_frame) {
-            size_t unpadded_linesize = frame_audio->nb_samples * av_get_bytes_per_sample(frame_audio->format);
-		frame_audio->linesize[0] = unpadded_linesize;	// for test
-#if 1
-		debug_info("audio_frame n:%d nb_samples:%d pts:%d\n",
-			audio_frame_count++, frame_audio->nb_samples,
-			get_audio_pts());
-#endif
-            /* Write the raw audio data samples of the first plane. This works
-             * fine for packed formats (e.g. AV_SAMPLE_FMT_S16). However,
-             * most audio decoders output planar audio, which uses a separate
-             * plane of audio samples for each channel (e.g. AV_SAMPLE_FMT_S16P).
-             * In other words, this code will write only the first audio channel
-             * in these cases.
-             * You should use libswresample or libavfilter to convert the frame
-             * to packed data. */
-            //fwrite(frame_audio->extended_data[0], 1, unpadded_linesize, audio_file);
+		stats_add_frames(p, STATS_AUDIO_DECODE, 1);
+		debug_info("audio_frame n:%d nb_samples:%d pts:%s\n",
+			as->audio_frame_count++, as->frame_audio->nb_samples,
+			av_ts2str(av_frame_get_best_effort_timestamp(as->frame_audio)));
+
+		as->frame_audio->pts = av_frame_get_best_effort_timestamp(as->frame_audio);
+
+		if (as->frame_filtered)
+			audio_follow_frame(p, as->frame_audio);
+
+		ret = as->afilter_graph ? filter_audio(p, as->frame_audio) :
+			audio_queue_frame(p, as->frame_audio, (as->frame_audio->pts == AV_NOPTS_VALUE) ? NAN :
+				as->frame_audio->pts * av_q2d(as->audio_stream->time_base), 1.0);
+		av_frame_unref(as->frame_audio);
+		if (ret < 0)
+			return ret;
         }
     }
 
     return decoded;
 }
 
-int open_audio_codec(AVFormatContext *fmt_ctx)
+/* allocates p->audio, close_audio_codec frees it even if this fails */
+int open_audio_codec(Player *p)
 {
-	int ret = open_codec_context(&audio_stream_idx, fmt_ctx, AVMEDIA_TYPE_AUDIO);
+	AudioState *as = p->audio = av_mallocz(sizeof(AudioState));
+	if (!as)
+		return AVERROR(ENOMEM);
+
+	as->afilter_speed = 1.0;
+	as->afilter_pts = NAN;
+	SDL_AtomicSet(&as->audio_speed, 100);
+	as->audio_write_clock = NAN;
+	as->audio_write_speed = 1.0;
+	as->audio_flush_target = NAN;
+	as->audio_seek_target = NAN;
+	as->audio_finished = -1;
+
+	int ret = open_codec_context(p, &as->audio_stream_idx, AVMEDIA_TYPE_AUDIO);
 	if (ret >= 0) {
-		packet_queue_init(&audio_queue);
-
-		frame_audio = av_frame_alloc();
-		if (!frame_audio) {
+		as->frame_audio = av_frame_alloc();
+		if (!as->frame_audio) {
 			fprintf(stderr, "Could not allocate frame\n");
 			return AVERROR(ENOMEM);
 		}
 
-		audio_stream = fmt_ctx->streams[audio_stream_idx];
-		audio_dec_ctx = audio_stream->codec;
+		as->audio_stream = p->fmt_ctx->streams[as->audio_stream_idx];
+		as->audio_dec_ctx = as->audio_stream->codec;
+
+		if ((ret = packet_queue_init(&as->audio_queue, as->audio_stream->time_base,
+			p->opts.max_queue_size, p->opts.max_queue_time)) < 0) {
+			fprintf(stderr, "Could not allocate packet queue\n");
+			return ret;
+		}
+		stats_register_queue(p, "audio", &as->audio_queue);
+
+		as->audio_task = task_create("audio_decode", audio_decode_step, p);
+		if (!as->audio_task)
+			return AVERROR(ENOMEM);
+		as->audio_queue.producer = p->demux_task;
+		as->audio_queue.consumer = as->audio_task;
 	}
 
 	return ret;
 }
 
-int close_audio_codec(void)
+int close_audio_codec(Player *p)
 {
-	av_frame_free(&frame_audio);
-	avcodec_close(audio_dec_ctx);
+	AudioState *as = p->audio;
+
+	if (!as)
+		return 0;
+
+	/* no more callbacks after this, they wake the task */
+	if (as->audio_dev)
+		SDL_CloseAudioDevice(as->audio_dev);
+
+	/* it stops on the aborted queue, even if it never ran */
+	if (as->audio_task)
+		packet_queue_abort(&as->audio_queue);
+	task_join(as->audio_task);
+	task_free(&as->audio_task);
+
+	ring_buffer_destroy(&as->audio_ring);
+	packet_queue_destroy(&as->audio_queue);
+	swr_free(&as->swr_ctx);
+	avfilter_graph_free(&as->afilter_graph);
+	av_frame_free(&as->frame_filtered);
+	av_freep(&as->audio_buf);
+	as->audio_buf_size = 0;
+	av_freep(&as->audio_pending);
+	as->audio_pending_size = 0;
+	av_frame_free(&as->frame_audio);
+	avcodec_close(as->audio_dec_ctx);
+	av_freep(&p->audio);
+	return 0;
 }
 
-int sdl_audio_init(void)
+int sdl_audio_init(Player *p)
 {
-	SDL_AudioSpec wanted_spec, spec;
+	AudioState *as = p->audio;
+	SDL_AudioSpec wanted_spec;
 	memset(&wanted_spec, 0, sizeof(wanted_spec));
-	memset(&spec, 0, sizeof(spec));
+	memset(&as->audio_spec, 0, sizeof(as->audio_spec));
 
-	// Set audio settings from codec info
-	wanted_spec.freq = audio_dec_ctx->sample_rate;
-	wanted_spec.format = get_format(audio_dec_ctx->sample_fmt);
-	wanted_spec.channels = audio_dec_ctx->channels;
-	wanted_spec.samples = audio_dec_ctx->frame_size;
+	// Set audio settings from codec info, the device always gets packed samples
+	wanted_spec.freq = as->audio_dec_ctx->sample_rate;
+	wanted_spec.format = get_format(av_get_packed_sample_fmt(as->audio_dec_ctx->sample_fmt));
+	if (!wanted_spec.format) {
+		wanted_spec.format = AUDIO_S16SYS;
+	}
+	wanted_spec.channels = as->audio_dec_ctx->channels;
+	/* about 10 ms device buffers for live sources, every buffer is latency */
+	wanted_spec.samples = FFMAX(512, 2 << av_log2(wanted_spec.freq / (live_enabled(p) ? 100 : 30)));
+	wanted_spec.silence = 0;
 	wanted_spec.callback = audio_proc;
-	wanted_spec.userdata = &spec;
+	wanted_spec.userdata = p;
 
-	if (SDL_OpenAudio(&wanted_spec, &spec) < 0) {
-		fprintf(stderr, "SDL_OpenAudio: %s\n", SDL_GetError());
+	/* the benchmark has no device, convert to what we would have asked for */
+	if (bench_enabled(p)) {
+		as->audio_spec = wanted_spec;
+		as->audio_spec.size = wanted_spec.samples * wanted_spec.channels *
+			av_get_bytes_per_sample(get_sample_fmt(wanted_spec.format));
+	} else {
+		/* a device of our own, other players in the process open theirs */
+		as->audio_dev = SDL_OpenAudioDevice(NULL, 0, &wanted_spec, &as->audio_spec, 0);
+		if (!as->audio_dev) {
+			fprintf(stderr, "SDL_OpenAudioDevice: %s\n", SDL_GetError());
+			return 1;
+		}
+	}
+
+	as->audio_tgt.fmt = get_sample_fmt(as->audio_spec.format);
+	if (as->audio_tgt.fmt == AV_SAMPLE_FMT_NONE) {
+		fprintf(stderr, "SDL advised audio format %d is not supported!\n", as->audio_spec.format);
 		return 1;
 	}
 
+	as->audio_tgt.freq = as->audio_spec.freq;
+	as->audio_tgt.channels = as->audio_spec.channels;
+	as->audio_tgt.channel_layout = av_get_default_channel_layout(as->audio_spec.channels);
+	as->audio_tgt.bytes_per_sec = av_samples_get_buffer_size(NULL, as->audio_tgt.channels,
+		as->audio_tgt.freq, as->audio_tgt.fmt, 1);
+	as->audio_src = as->audio_tgt;
+
+	/* half a second of device audio, a tenth for live sources, and never less than a few device buffers */
+	if (ring_buffer_init(&as->audio_ring, FFMAX(as->audio_tgt.bytes_per_sec / (live_enabled(p) ? 10 : 2),
+		4 * as->audio_spec.size)) < 0) {
+		fprintf(stderr, "Could not allocate audio buffer\n");
+		return 1;
+	}
+	as->audio_ring.producer = as->audio_task;
+
+	debug_info("audio device %d Hz %s %d channels, %d bytes buffer\n",
+		as->audio_tgt.freq, av_get_sample_fmt_name(as->audio_tgt.fmt), as->audio_tgt.channels,
+		as->audio_spec.size);
+
 	return 0;
 }
 
-/* inline */ int is_audio_packet(const AVPacket *pkt)
+/* inline */ int is_audio_packet(Player *p, const AVPacket *pkt)
 {
-	return (pkt->stream_index == audio_stream_idx);
+	return (pkt->stream_index == p->audio->audio_stream_idx);
 }
 
-/* inline */ int audio_enqueue(const AVPacket *pkt)
+/* inline */ int audio_enqueue(Player *p, const AVPacket *pkt)
 {
-	return packet_queue_put(&audio_queue, pkt);
+	return packet_queue_put(&p->audio->audio_queue, pkt, 0);
 }
 
-/* inline */ int audio_dequeue(AVPacket *pkt)
+/* demuxer only: adds what is queued to *size */
+/* inline */ int audio_queue_enough(Player *p, int *size)
 {
-	return packet_queue_get(&audio_queue, pkt);
+	*size += packet_queue_size(&p->audio->audio_queue);
+	return packet_queue_enough(&p->audio->audio_queue);
 }
 
-/* inline */ void audio_start()
+/* inline */ int audio_dequeue(Player *p, AVPacket *pkt)
 {
-	SDL_PauseAudio(0);
+	return packet_queue_get(&p->audio->audio_queue, pkt, 1, NULL);
+}
+
+/* inline */ void audio_abort(Player *p)
+{
+	AudioState *as = p->audio;
+
+	packet_queue_abort(&as->audio_queue);
+	ring_buffer_abort(&as->audio_ring);
+}
+
+/* inline */ void audio_interrupt(Player *p)
+{
+	packet_queue_interrupt(&p->audio->audio_queue);
+}
+
+/* demuxer only, right after a seek to target */
+/* inline */ void audio_flush(Player *p, double target)
+{
+	AudioState *as = p->audio;
+
+	as->audio_flush_target = target;
+	packet_queue_flush(&as->audio_queue);
+}
+
+/* demuxer only: queue stream_index from now on, the decoder switches over at the flush */
+void audio_switch_stream(Player *p, int stream_index)
+{
+	AudioState *as = p->audio;
+
+	as->audio_stream_idx = stream_index;
+	packet_queue_set_time_base(&as->audio_queue, p->fmt_ctx->streams[stream_index]->time_base);
+	audio_flush(p, NAN);
+}
+
+/* inline */ int audio_get_stream(Player *p)
+{
+	return p->audio->audio_stream_idx;
+}
+
+/* demuxer only, queue an empty packet to drain the decoder, EAGAIN while the queue is full */
+/* inline */ int audio_eof(Player *p)
+{
+	AudioState *as = p->audio;
+	AVPacket pkt;
+
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
+	pkt.stream_index = as->audio_stream_idx;
+	return packet_queue_put(&as->audio_queue, &pkt, 0);
+}
+
+/* --bench: empty the ring as if the device played it, returns 0 if it was empty;
+ * --output: and hand what was read to the encoder, with the pts of its first sample */
+int audio_bench_step(Player *p)
+{
+	AudioState *as = p->audio;
+	uint8_t buf[4096];
+	int len = 0, total = 0;
+	double clock = NAN;
+
+	while ((len = ring_buffer_read(&as->audio_ring, buf, sizeof(buf))) > 0) {
+		SDL_AtomicLock(&as->audio_clock_lock);
+		if (!isnan(as->audio_write_clock))
+			clock = as->audio_write_clock - (double)(as->audio_write_pos - as->audio_read_pos) /
+				as->audio_tgt.bytes_per_sec * as->audio_write_speed;
+		as->audio_read_pos += len;
+		SDL_AtomicUnlock(&as->audio_clock_lock);
+
+		if (export_enabled(p))
+			export_audio_samples(p, buf, len, clock);
+		total += len;
+	}
+
+	return total > 0;
+}
+
+/* the format of the samples in the ring, -1 before sdl_audio_init */
+int audio_get_output(Player *p, int *freq, int *channels, int64_t *channel_layout, enum AVSampleFormat *fmt)
+{
+	AudioState *as = p->audio;
+
+	if (!as || !as->audio_tgt.freq)
+		return -1;
+
+	*freq = as->audio_tgt.freq;
+	*channels = as->audio_tgt.channels;
+	*channel_layout = as->audio_tgt.channel_layout;
+	*fmt = as->audio_tgt.fmt;
+
+	return 0;
+}
+
+/* inline */ int audio_bench_done(Player *p)
+{
+	AudioState *as = p->audio;
+
+	return as->audio_finished == packet_queue_serial(&as->audio_queue) &&
+		!ring_buffer_fill(&as->audio_ring);
+}
+
+/* any thread, the decoder picks it up with its next frame */
+/* inline */ void audio_set_speed(Player *p, double speed)
+{
+	SDL_AtomicSet(&p->audio->audio_speed, lrint(speed * 100));
+}
+
+/* inline */ void audio_start(Player *p)
+{
+	AudioState *as = p->audio;
+
+	task_wake(as->audio_task);
+
+	if (as->audio_dev)
+		SDL_PauseAudioDevice(as->audio_dev, 0);
 }
 
-/* inline */ void audio_stop()
+/* inline */ void audio_stop(Player *p)
 {
-	SDL_PauseAudio(1);
+	if (p->audio->audio_dev)
+		SDL_PauseAudioDevice(p->audio->audio_dev, 1);
 }
 
-/* inline */ int get_audio_pts()
+/* inline */ int get_audio_pts(Player *p)
 {
-	int64_t pts = frame_audio ? av_frame_get_best_effort_timestamp(frame_audio) : AV_NOPTS_VALUE;
-	if (pts == AV_NOPTS_VALUE) {
+	double pts = clock_get(sync_clock(p, AV_SYNC_AUDIO_MASTER));
+	if (isnan(pts)) {
 		return -1;
 	} else {
-		return av_rescale(pts, 1000, frame_audio->sample_rate);
+		return pts * 1000;
 	}
 }
 
@@ -1,19 +1,33 @@
 #ifndef __AUDIO_H__
 #define __AUDIO_H__
 
-int sdl_audio_init(void);
+int sdl_audio_init(Player *p);
+int init_audio_filters(Player *p, const char *af);
 
-int open_audio_codec(AVFormatContext *fmt_ctx);
-int close_audio_codec(void);
-int decode_audio_packet(AVPacket *pkt);
+int open_audio_codec(Player *p);
+int close_audio_codec(Player *p);
+int decode_audio_packet(Player *p, AVPacket *pkt);
 
-int is_audio_packet(const AVPacket *pkt);
-int audio_enqueue(const AVPacket *pkt);
-int audio_dequeue(AVPacket *pkt);
+int is_audio_packet(Player *p, const AVPacket *pkt);
+int audio_enqueue(Player *p, const AVPacket *pkt);
+int audio_queue_enough(Player *p, int *size);
+int audio_dequeue(Player *p, AVPacket *pkt);
 
-void audio_start();
-void audio_stop();
+void audio_abort(Player *p);
+void audio_interrupt(Player *p);
+void audio_flush(Player *p, double target);
+void audio_switch_stream(Player *p, int stream_index);
+int audio_get_stream(Player *p);
+int audio_eof(Player *p);
+void audio_start(Player *p);
+void audio_stop(Player *p);
+void audio_set_speed(Player *p, double speed);
 
-int get_audio_pts();
+int audio_bench_step(Player *p);
+int audio_bench_done(Player *p);
+
+int audio_get_output(Player *p, int *freq, int *channels, int64_t *channel_layout, enum AVSampleFormat *fmt);
+
+int get_audio_pts(Player *p);
 
 #endif
@@ -0,0 +1,76 @@
+#include "config.h"
+
+#include <math.h>
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+#include "internal.h"
+#include "stats.h"
+#include "bench.h"
+
+/* inline */ int bench_enabled(Player *p)
+{
+	return p->headless;
+}
+
+/* peak resident set size in KiB, -1 if we can't tell */
+static long bench_peak_rss(void)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+	struct rusage usage;
+
+	if (!getrusage(RUSAGE_SELF, &usage))
+		return usage.ru_maxrss;
+#endif
+	return -1;
+}
+
+/* s as a JSON string, quotes included; UTF-8 goes through as it is */
+static void bench_json_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+void bench_report(Player *p, FILE *out, const char *infile, double wall_time, double media_time)
+{
+	int i = 0;
+	int video_frames = stats_stage(p, STATS_VIDEO_DECODE)->frames;
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"input\": ");
+	bench_json_string(out, infile);
+	fprintf(out, ",\n");
+	fprintf(out, "  \"wall_time\": %.6f,\n", wall_time);
+	fprintf(out, "  \"media_time\": %.6f,\n", media_time);
+	fprintf(out, "  \"speed\": %.3f,\n", wall_time > 0 ? media_time / wall_time : 0);
+	fprintf(out, "  \"video_frames\": %d,\n", video_frames);
+	fprintf(out, "  \"fps\": %.3f,\n", wall_time > 0 ? video_frames / wall_time : 0);
+	if (!isnan(stats_time_to_first_frame(p)))
+		fprintf(out, "  \"first_frame\": %.6f,\n", stats_time_to_first_frame(p));
+	fprintf(out, "  \"peak_rss_kb\": %ld,\n", bench_peak_rss());
+	fprintf(out, "  \"stages\": {\n");
+
+	for (i = 0; i < STATS_NB_STAGES; i++) {
+		const StatsStage *s = stats_stage(p, i);
+		fprintf(out, "    \"%s\": { \"time\": %.6f, \"calls\": %"PRId64", \"frames\": %d, \"bytes\": %"PRId64", \"mb_per_s\": %.1f, \"us_per_call\": %.3f }%s\n",
+			s->name, s->time.sum / 1000000.0, s->time.count, s->frames, s->bytes,
+			s->time.sum ? s->bytes / (double)s->time.sum : 0,
+			s->time.count ? (double)s->time.sum / s->time.count : 0,
+			(i < STATS_NB_STAGES - 1) ? "," : "");
+	}
+
+	fprintf(out, "  }\n");
+	fprintf(out, "}\n");
+}
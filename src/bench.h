@@ -0,0 +1,11 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdio.h>
+
+/* --bench: no pacing and no devices, the stage times come from stats.h */
+int bench_enabled(Player *p);
+
+void bench_report(Player *p, FILE *out, const char *infile, double wall_time, double media_time);
+
+#endif
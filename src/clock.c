@@ -0,0 +1,156 @@
+#include <math.h>
+
+#include <SDL2/SDL_timer.h>
+
+#include <libavutil/mem.h>
+
+#include "internal.h"
+#include "clock.h"
+
+struct SyncState {
+	Clock audclk, vidclk, extclk;
+	int av_sync_type;
+};
+
+/* high resolution and monotonic, every clock and the frame schedule run on it */
+double clock_time(void)
+{
+	static double period = 0;
+
+	if (!period)
+		period = 1.0 / SDL_GetPerformanceFrequency();
+
+	return SDL_GetPerformanceCounter() * period;
+}
+
+void clock_init(Clock *c)
+{
+	c->speed = 1.0;
+	c->paused = 0;
+	clock_set(c, NAN);
+}
+
+double clock_get(Clock *c)
+{
+	if (c->paused) {
+		return c->pts;
+	} else {
+		double time = clock_time();
+		return c->pts_drift + time - (time - c->last_updated) * (1.0 - c->speed);
+	}
+}
+
+void clock_set_at(Clock *c, double pts, double time)
+{
+	c->pts = pts;
+	c->last_updated = time;
+	c->pts_drift = c->pts - time;
+}
+
+/* inline */ void clock_set(Clock *c, double pts)
+{
+	clock_set_at(c, pts, clock_time());
+}
+
+/* freeze the clock at its current value, or restart it from there */
+void clock_set_paused(Clock *c, int paused)
+{
+	clock_set(c, clock_get(c));
+	c->paused = paused;
+}
+
+void clock_sync_to_slave(Clock *c, Clock *slave)
+{
+	double clock = clock_get(c);
+	double slave_clock = clock_get(slave);
+
+	if (!isnan(slave_clock) && (isnan(clock) || fabs(clock - slave_clock) > AV_NOSYNC_THRESHOLD))
+		clock_set(c, slave_clock);
+}
+
+int sync_init(Player *p, int master)
+{
+	SyncState *sc = p->sync = av_mallocz(sizeof(SyncState));
+	if (!sc)
+		return AVERROR(ENOMEM);
+
+	sc->av_sync_type = master;
+
+	clock_init(&sc->audclk);
+	clock_init(&sc->vidclk);
+	clock_init(&sc->extclk);
+	return 0;
+}
+
+/* inline */ void sync_close(Player *p)
+{
+	av_freep(&p->sync);
+}
+
+/* inline */ int sync_master_type(Player *p)
+{
+	return p->sync->av_sync_type;
+}
+
+Clock *sync_clock(Player *p, int type)
+{
+	SyncState *sc = p->sync;
+
+	switch (type) {
+	case AV_SYNC_AUDIO_MASTER:
+		return &sc->audclk;
+	case AV_SYNC_VIDEO_MASTER:
+		return &sc->vidclk;
+	default:
+		return &sc->extclk;
+	}
+}
+
+/* fall back to the external clock until the master clock has been set */
+double sync_get_master(Player *p)
+{
+	SyncState *sc = p->sync;
+	double val = clock_get(sync_clock(p, sc->av_sync_type));
+
+	if (isnan(val))
+		val = clock_get(&sc->extclk);
+
+	return val;
+}
+
+void sync_set_paused(Player *p, int paused)
+{
+	SyncState *sc = p->sync;
+
+	clock_set_paused(&sc->audclk, paused);
+	clock_set_paused(&sc->vidclk, paused);
+	clock_set_paused(&sc->extclk, paused);
+}
+
+/* every clock goes on from where it is, at speed */
+void sync_set_speed(Player *p, double speed)
+{
+	SyncState *sc = p->sync;
+	Clock *clocks[] = { &sc->audclk, &sc->vidclk, &sc->extclk };
+	int i = 0;
+
+	for (i = 0; i < 3; i++) {
+		clock_set(clocks[i], clock_get(clocks[i]));
+		clocks[i]->speed = speed;
+	}
+}
+
+/* inline */ double sync_get_speed(Player *p)
+{
+	return p->sync->extclk.speed;
+}
+
+/* after a seek: forget where the streams were, the wall clock restarts from pts */
+void sync_reset(Player *p, double pts)
+{
+	SyncState *sc = p->sync;
+
+	clock_set(&sc->audclk, NAN);
+	clock_set(&sc->vidclk, NAN);
+	clock_set(&sc->extclk, pts);
+}
@@ -0,0 +1,47 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+/* no A/V correction is done if the error is too big */
+#define AV_NOSYNC_THRESHOLD 10.0
+/* A/V sync correction thresholds, in seconds */
+#define AV_SYNC_THRESHOLD_MIN 0.04
+#define AV_SYNC_THRESHOLD_MAX 0.1
+/* frames longer than this are not duplicated to catch up */
+#define AV_SYNC_FRAMEDUP_THRESHOLD 0.1
+/* a frame duration above this is considered a timestamp discontinuity */
+#define AV_SYNC_MAX_FRAME_DURATION 10.0
+
+enum {
+	AV_SYNC_AUDIO_MASTER = PLAYER_SYNC_AUDIO,
+	AV_SYNC_VIDEO_MASTER = PLAYER_SYNC_VIDEO,
+	AV_SYNC_EXTERNAL_CLOCK = PLAYER_SYNC_EXTERNAL,
+};
+
+typedef struct Clock {
+	double pts;		// clock base, in seconds
+	double pts_drift;	// clock base minus the time at which we updated the clock
+	double last_updated;
+	double speed;
+	int paused;
+} Clock;
+
+double clock_time(void);
+
+void clock_init(Clock *c);
+double clock_get(Clock *c);
+void clock_set_at(Clock *c, double pts, double time);
+void clock_set(Clock *c, double pts);
+void clock_set_paused(Clock *c, int paused);
+void clock_sync_to_slave(Clock *c, Clock *slave);
+
+int sync_init(Player *p, int master);
+void sync_close(Player *p);
+int sync_master_type(Player *p);
+Clock *sync_clock(Player *p, int type);
+double sync_get_master(Player *p);
+void sync_set_paused(Player *p, int paused);
+void sync_set_speed(Player *p, double speed);
+double sync_get_speed(Player *p);
+void sync_reset(Player *p, double pts);
+
+#endif
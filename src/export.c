@@ -0,0 +1,453 @@
+#include "config.h"
+
+#include <math.h>
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/audio_fifo.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/cpu.h>
+#include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
+
+#include "internal.h"
+#include "debug.h"
+#include "stats.h"
+#include "video.h"
+#include "audio.h"
+#include "export.h"
+
+typedef struct OutputStream {
+	AVStream *st;
+	AVCodecContext *enc_ctx;
+	AVFrame *frame;		// what we hand the encoder, in its format
+	int64_t next_pts;	// in enc_ctx->time_base
+} OutputStream;
+
+struct ExportState {
+	AVFormatContext *ofmt_ctx;
+	OutputStream video_ost;
+	OutputStream audio_ost;
+	int64_t export_start_time;	// of the input, in AV_TIME_BASE
+	int header_written;
+
+	struct SwsContext *sws_ctx;
+	struct SwrContext *swr_ctx;
+	AVAudioFifo *audio_fifo;
+	int audio_src_channels;
+	enum AVSampleFormat audio_src_fmt;
+};
+
+/* inline */ int export_enabled(Player *p)
+{
+	return p->export != NULL;
+}
+
+static AVCodec *find_encoder(const char *name, enum AVCodecID id, enum AVMediaType type)
+{
+	AVCodec *codec = name ? avcodec_find_encoder_by_name(name) : avcodec_find_encoder(id);
+
+	if (!codec || codec->type != type) {
+		fprintf(stderr, "Could not find %s encoder %s\n", av_get_media_type_string(type),
+			name ? name : avcodec_get_name(id));
+		return NULL;
+	}
+
+	return codec;
+}
+
+static int open_encoder(Player *p, OutputStream *ost, AVCodec *codec, int threads)
+{
+	int ret = 0;
+
+	ost->enc_ctx->thread_count = threads ? threads : FFMIN(av_cpu_count() + 1, 16);
+	ost->enc_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	if (p->export->ofmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+		ost->enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+	if ((ret = avcodec_open2(ost->enc_ctx, codec, NULL)) < 0) {
+		fprintf(stderr, "Could not open %s encoder %s (%s)\n",
+			av_get_media_type_string(codec->type), codec->name, av_err2str(ret));
+		return ret;
+	}
+
+	if ((ret = avcodec_parameters_from_context(ost->st->codecpar, ost->enc_ctx)) < 0)
+		return ret;
+	ost->st->time_base = ost->enc_ctx->time_base;
+
+	debug_info("%s encoder %s opened with %d thread(s), type %d\n",
+		av_get_media_type_string(codec->type), codec->name,
+		ost->enc_ctx->thread_count, ost->enc_ctx->active_thread_type);
+
+	return 0;
+}
+
+static int add_video_stream(Player *p, const char *name, int threads)
+{
+	ExportState *es = p->export;
+	int w = 0, h = 0;
+	enum AVPixelFormat pix_fmt = AV_PIX_FMT_NONE;
+	AVRational sar, time_base, frame_rate;
+	AVCodec *codec = NULL;
+	AVCodecContext *c = NULL;
+
+	if (video_get_output(p, &w, &h, &pix_fmt, &sar, &time_base, &frame_rate) < 0)
+		return 0;
+
+	codec = find_encoder(name, es->ofmt_ctx->oformat->video_codec, AVMEDIA_TYPE_VIDEO);
+	if (!codec)
+		return AVERROR_ENCODER_NOT_FOUND;
+
+	es->video_ost.st = avformat_new_stream(es->ofmt_ctx, NULL);
+	es->video_ost.enc_ctx = c = avcodec_alloc_context3(codec);
+	es->video_ost.frame = av_frame_alloc();
+	if (!es->video_ost.st || !c || !es->video_ost.frame)
+		return AVERROR(ENOMEM);
+
+	c->width = w;
+	c->height = h;
+	c->sample_aspect_ratio = sar;
+	c->pix_fmt = codec->pix_fmts ?
+		avcodec_find_best_pix_fmt_of_list(codec->pix_fmts, pix_fmt, 0, NULL) : pix_fmt;
+	/* the ticks of the filters or the stream, so variable frame rates keep
+	 * their pts; MPEG-1/2 only take one tick per frame, MPEG-4 16 bit ticks */
+	c->time_base = time_base;
+	if (codec->supported_framerates)
+		c->time_base = av_inv_q(frame_rate);
+	else if (codec->id == AV_CODEC_ID_MPEG4 && c->time_base.den > 65535)
+		av_reduce(&c->time_base.num, &c->time_base.den, time_base.num, time_base.den, 65535);
+	c->framerate = frame_rate;
+	es->video_ost.st->sample_aspect_ratio = sar;
+	es->video_ost.st->avg_frame_rate = frame_rate;
+	es->video_ost.next_pts = AV_NOPTS_VALUE;
+
+	return open_encoder(p, &es->video_ost, codec, threads);
+}
+
+static int add_audio_stream(Player *p, const char *name, int threads)
+{
+	ExportState *es = p->export;
+	int freq = 0, channels = 0, i = 0;
+	int64_t channel_layout = 0;
+	AVCodec *codec = NULL;
+	AVCodecContext *c = NULL;
+	int ret = 0;
+
+	if (audio_get_output(p, &freq, &channels, &channel_layout, &es->audio_src_fmt) < 0)
+		return 0;
+
+	codec = find_encoder(name, es->ofmt_ctx->oformat->audio_codec, AVMEDIA_TYPE_AUDIO);
+	if (!codec)
+		return AVERROR_ENCODER_NOT_FOUND;
+
+	es->audio_ost.st = avformat_new_stream(es->ofmt_ctx, NULL);
+	es->audio_ost.enc_ctx = c = avcodec_alloc_context3(codec);
+	es->audio_ost.frame = av_frame_alloc();
+	if (!es->audio_ost.st || !c || !es->audio_ost.frame)
+		return AVERROR(ENOMEM);
+
+	c->sample_fmt = codec->sample_fmts ? codec->sample_fmts[0] : es->audio_src_fmt;
+	c->sample_rate = freq;
+	if (codec->supported_samplerates) {
+		c->sample_rate = codec->supported_samplerates[0];
+		for (i = 0; codec->supported_samplerates[i]; i++) {
+			if (codec->supported_samplerates[i] == freq)
+				c->sample_rate = freq;
+		}
+	}
+	c->channel_layout = channel_layout;
+	c->channels = channels;
+	c->time_base = (AVRational){ 1, c->sample_rate };
+	es->audio_ost.next_pts = AV_NOPTS_VALUE;
+	es->audio_src_channels = channels;
+
+	if ((ret = open_encoder(p, &es->audio_ost, codec, threads)) < 0)
+		return ret;
+
+	es->swr_ctx = swr_alloc_set_opts(NULL,
+		c->channel_layout, c->sample_fmt, c->sample_rate,
+		channel_layout, es->audio_src_fmt, freq, 0, NULL);
+	if (!es->swr_ctx || swr_init(es->swr_ctx) < 0) {
+		fprintf(stderr, "Cannot create the audio converter for the %s encoder\n", codec->name);
+		return AVERROR(EINVAL);
+	}
+
+	es->audio_fifo = av_audio_fifo_alloc(c->sample_fmt, c->channels, FFMAX(c->frame_size, 1024));
+	if (!es->audio_fifo)
+		return AVERROR(ENOMEM);
+
+	return 0;
+}
+
+/* encoders and threads as in the options, export_close even if this fails */
+int export_open(Player *p, const char *filename)
+{
+	ExportState *es = p->export = av_mallocz(sizeof(ExportState));
+	if (!es)
+		return AVERROR(ENOMEM);
+
+	es->audio_src_fmt = AV_SAMPLE_FMT_NONE;
+
+	int ret = avformat_alloc_output_context2(&es->ofmt_ctx, NULL, NULL, filename);
+	if (ret < 0) {
+		fprintf(stderr, "Could not deduce the output format from %s\n", filename);
+		return ret;
+	}
+
+	es->export_start_time = p->fmt_ctx->start_time;
+
+	if ((ret = add_video_stream(p, p->opts.video_codec, p->opts.decode_threads)) < 0 ||
+		(ret = add_audio_stream(p, p->opts.audio_codec, p->opts.decode_threads)) < 0)
+		return ret;
+
+	av_dump_format(es->ofmt_ctx, 0, filename, 1);
+
+	if (!(es->ofmt_ctx->oformat->flags & AVFMT_NOFILE) &&
+		(ret = avio_open(&es->ofmt_ctx->pb, filename, AVIO_FLAG_WRITE)) < 0) {
+		fprintf(stderr, "Could not open output file %s\n", filename);
+		return ret;
+	}
+
+	if ((ret = avformat_write_header(es->ofmt_ctx, NULL)) < 0) {
+		fprintf(stderr, "Could not write the header of %s (%s)\n", filename, av_err2str(ret));
+		return ret;
+	}
+
+	es->header_written = 1;
+	return 0;
+}
+
+/* send frame, NULL to drain, and mux whatever comes out */
+static int encode(Player *p, OutputStream *ost, AVFrame *frame, int stage)
+{
+	AVPacket pkt;
+	int64_t begin = stats_begin();
+	int ret = avcodec_send_frame(ost->enc_ctx, frame);
+
+	if (ret < 0) {
+		stats_end(p, stage, begin);
+		fprintf(stderr, "Error sending a frame to the encoder (%s)\n", av_err2str(ret));
+		return ret;
+	}
+
+	for (;;) {
+		av_init_packet(&pkt);
+		pkt.data = NULL;
+		pkt.size = 0;
+
+		ret = avcodec_receive_packet(ost->enc_ctx, &pkt);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+			ret = 0;
+			break;
+		}
+		if (ret < 0) {
+			fprintf(stderr, "Error encoding a frame (%s)\n", av_err2str(ret));
+			break;
+		}
+
+		stats_add_frames(p, stage, 1);
+		av_packet_rescale_ts(&pkt, ost->enc_ctx->time_base, ost->st->time_base);
+		pkt.stream_index = ost->st->index;
+
+		ret = av_interleaved_write_frame(p->export->ofmt_ctx, &pkt);
+		if (ret < 0) {
+			fprintf(stderr, "Error writing a packet (%s)\n", av_err2str(ret));
+			break;
+		}
+	}
+
+	stats_end(p, stage, begin);
+	return ret;
+}
+
+int export_video_frame(Player *p, AVFrame *frame, AVRational time_base)
+{
+	ExportState *es = p->export;
+	AVCodecContext *c = es->video_ost.enc_ctx;
+	AVFrame *out = frame;
+	int64_t pts = 0;
+	int ret = 0;
+
+	if (!c)
+		return 0;
+
+	/* the encoder may not take what the filters or the decoder give us */
+	if (frame->format != c->pix_fmt || frame->width != c->width || frame->height != c->height) {
+		es->sws_ctx = sws_getCachedContext(es->sws_ctx,
+			frame->width, frame->height, frame->format,
+			c->width, c->height, c->pix_fmt,
+			SWS_BICUBIC, NULL, NULL, NULL);
+		if (!es->sws_ctx) {
+			fprintf(stderr, "Cannot initialize the conversion context\n");
+			return -1;
+		}
+
+		out = es->video_ost.frame;
+		av_frame_unref(out);
+		out->format = c->pix_fmt;
+		out->width = c->width;
+		out->height = c->height;
+		if ((ret = av_frame_get_buffer(out, 32)) < 0)
+			return ret;
+
+		sws_scale(es->sws_ctx, (const uint8_t * const *)frame->data, frame->linesize,
+			0, frame->height, out->data, out->linesize);
+	}
+
+	/* output starts at 0, and never goes back even when rounding says so */
+	if (frame->pts != AV_NOPTS_VALUE) {
+		pts = av_rescale_q(frame->pts, time_base, c->time_base);
+		if (es->export_start_time != AV_NOPTS_VALUE)
+			pts -= av_rescale_q(es->export_start_time, AV_TIME_BASE_Q, c->time_base);
+	} else if (es->video_ost.next_pts != AV_NOPTS_VALUE) {
+		/* a frame later than the last one */
+		pts = es->video_ost.next_pts - 1 + FFMAX(1, av_rescale_q(1, av_inv_q(c->framerate), c->time_base));
+	} else {
+		pts = AV_NOPTS_VALUE;
+	}
+	if (es->video_ost.next_pts != AV_NOPTS_VALUE)
+		pts = FFMAX(pts, es->video_ost.next_pts);
+	if (pts == AV_NOPTS_VALUE)
+		pts = 0;
+
+	/* the caller still owns the frame, put its pts back afterwards */
+	int64_t frame_pts = frame->pts;
+	out->pts = pts;
+	es->video_ost.next_pts = pts + 1;
+
+	ret = encode(p, &es->video_ost, out, STATS_VIDEO_ENCODE);
+	frame->pts = frame_pts;
+
+	return ret;
+}
+
+/* hand the encoder whole frames out of the fifo, the last one may be short */
+static int encode_audio_fifo(Player *p, int flush)
+{
+	ExportState *es = p->export;
+	AVCodecContext *c = es->audio_ost.enc_ctx;
+	AVFrame *frame = es->audio_ost.frame;
+	int frame_size = (c->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE) || !c->frame_size ?
+		1024 : c->frame_size;
+	int ret = 0;
+
+	while (av_audio_fifo_size(es->audio_fifo) >= frame_size ||
+		(flush && av_audio_fifo_size(es->audio_fifo) > 0)) {
+		av_frame_unref(frame);
+		frame->nb_samples = FFMIN(frame_size, av_audio_fifo_size(es->audio_fifo));
+		frame->format = c->sample_fmt;
+		frame->channel_layout = c->channel_layout;
+		frame->channels = c->channels;
+		frame->sample_rate = c->sample_rate;
+		if ((ret = av_frame_get_buffer(frame, 0)) < 0)
+			return ret;
+
+		av_audio_fifo_read(es->audio_fifo, (void **)frame->data, frame->nb_samples);
+		frame->pts = es->audio_ost.next_pts;
+		es->audio_ost.next_pts += frame->nb_samples;
+
+		if ((ret = encode(p, &es->audio_ost, frame, STATS_AUDIO_ENCODE)) < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* nb_samples of in into the fifo, in NULL to get what the resampler holds back */
+static int export_resample(Player *p, const uint8_t **in, int nb_samples)
+{
+	ExportState *es = p->export;
+	AVCodecContext *c = es->audio_ost.enc_ctx;
+	uint8_t **samples = NULL;
+	int out_count = swr_get_out_samples(es->swr_ctx, nb_samples);
+	int ret = 0;
+
+	if (out_count <= 0)
+		return out_count;
+
+	if ((ret = av_samples_alloc_array_and_samples(&samples, NULL, c->channels,
+		out_count, c->sample_fmt, 0)) < 0)
+		return ret;
+
+	ret = swr_convert(es->swr_ctx, samples, out_count, in, nb_samples);
+	if (ret > 0)
+		ret = av_audio_fifo_write(es->audio_fifo, (void **)samples, ret);
+
+	av_freep(&samples[0]);
+	av_freep(&samples);
+
+	return ret;
+}
+
+/* buf holds packed samples as audio.c converts them, pts is the time of the first one */
+int export_audio_samples(Player *p, const uint8_t *buf, int len, double pts)
+{
+	ExportState *es = p->export;
+	AVCodecContext *c = es->audio_ost.enc_ctx;
+	int nb_samples = 0, ret = 0;
+
+	if (!c)
+		return 0;
+
+	/* counted from the first samples on, the output has no gaps */
+	if (es->audio_ost.next_pts == AV_NOPTS_VALUE) {
+		if (isnan(pts))
+			pts = 0;
+		if (es->export_start_time != AV_NOPTS_VALUE)
+			pts -= (double)es->export_start_time / AV_TIME_BASE;
+		es->audio_ost.next_pts = FFMAX(0, llrint(pts * c->sample_rate));
+	}
+
+	nb_samples = len / (es->audio_src_channels * av_get_bytes_per_sample(es->audio_src_fmt));
+	if ((ret = export_resample(p, &buf, nb_samples)) < 0)
+		return ret;
+
+	return encode_audio_fifo(p, 0);
+}
+
+/* drain the encoders and finish the file, then free everything */
+int export_close(Player *p)
+{
+	ExportState *es = p->export;
+	int ret = 0;
+
+	if (!es)
+		return 0;
+	if (!es->ofmt_ctx)
+		goto end;
+
+	if (es->header_written) {
+		if (es->audio_ost.enc_ctx) {
+			/* the resampler's filter delay, once samples went in at all */
+			if (es->audio_ost.next_pts != AV_NOPTS_VALUE)
+				export_resample(p, NULL, 0);
+			encode_audio_fifo(p, 1);
+			encode(p, &es->audio_ost, NULL, STATS_AUDIO_ENCODE);
+		}
+		if (es->video_ost.enc_ctx)
+			encode(p, &es->video_ost, NULL, STATS_VIDEO_ENCODE);
+
+		ret = av_write_trailer(es->ofmt_ctx);
+		es->header_written = 0;
+	}
+
+	avcodec_free_context(&es->video_ost.enc_ctx);
+	av_frame_free(&es->video_ost.frame);
+	avcodec_free_context(&es->audio_ost.enc_ctx);
+	av_frame_free(&es->audio_ost.frame);
+	sws_freeContext(es->sws_ctx);
+	es->sws_ctx = NULL;
+	swr_free(&es->swr_ctx);
+	if (es->audio_fifo) {
+		av_audio_fifo_free(es->audio_fifo);
+		es->audio_fifo = NULL;
+	}
+
+	if (!(es->ofmt_ctx->oformat->flags & AVFMT_NOFILE))
+		avio_closep(&es->ofmt_ctx->pb);
+	avformat_free_context(es->ofmt_ctx);
+
+end:
+	av_freep(&p->export);
+	return ret;
+}
@@ -0,0 +1,16 @@
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+/*
+ * --output: the headless pipeline of --bench, but the filtered frames and
+ * the converted audio are encoded into a file instead of being dropped.
+ * Encoders default to what the output format prefers.
+ */
+int export_open(Player *p, const char *filename);
+int export_close(Player *p);
+int export_enabled(Player *p);
+
+int export_video_frame(Player *p, AVFrame *frame, AVRational time_base);
+int export_audio_samples(Player *p, const uint8_t *buf, int len, double pts);
+
+#endif
@@ -0,0 +1,185 @@
+#include "config.h"
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <SDL2/SDL_atomic.h>
+
+#include "internal.h"
+#include "debug.h"
+#include "stats.h"
+#include "framepool.h"
+
+/* ABR streams go back and forth between a few sizes, keep a pool for each */
+#define FRAME_POOL_SIZES	4
+/* for the data pointers, the largest SIMD alignment libavcodec may use */
+#define FRAME_POOL_ALIGN	64
+
+typedef struct FramePoolEntry {
+	Player *p;
+	AVBufferPool *pool;
+	int width, height;
+	enum AVPixelFormat format;
+	int linesize[4];
+	ptrdiff_t offset[4];	// of each plane from the aligned start of the buffer
+	int size;
+	unsigned last_used;
+} FramePoolEntry;
+
+struct FramePool {
+	SDL_SpinLock lock;	// guards the entries, get_buffer2 comes from the frame threads
+	FramePoolEntry entries[FRAME_POOL_SIZES];
+	unsigned uses;
+};
+
+int frame_pool_init(Player *p)
+{
+	p->frame_pool = av_mallocz(sizeof(FramePool));
+	if (!p->frame_pool)
+		return AVERROR(ENOMEM);
+
+	return 0;
+}
+
+/* frames still out keep their pool alive, it goes away when they come back */
+void frame_pool_close(Player *p)
+{
+	FramePool *fp = p->frame_pool;
+	int i = 0;
+
+	if (!fp)
+		return;
+
+	for (i = 0; i < FRAME_POOL_SIZES; i++)
+		av_buffer_pool_uninit(&fp->entries[i].pool);
+	av_freep(&p->frame_pool);
+}
+
+/* only called when the pool is empty, so every call is a miss */
+static AVBufferRef *frame_pool_alloc(void *opaque, int size)
+{
+	FramePoolEntry *e = opaque;
+
+	stats_count(e->p, STATS_FRAME_POOL_MISSES);
+	return av_buffer_alloc(size);
+}
+
+/* the plane layout the decoder wants for this size, as avcodec_default_get_buffer2 does it */
+static int frame_pool_layout(AVCodecContext *avctx, FramePoolEntry *e)
+{
+	int linesize_align[AV_NUM_DATA_POINTERS];
+	uint8_t *data[4];
+	int w = e->width, h = e->height;
+	int i = 0, unaligned = 0, ret = 0;
+
+	avcodec_align_dimensions2(avctx, &w, &h, linesize_align);
+
+	/* widen until every plane has the stride alignment the decoder needs */
+	do {
+		if ((ret = av_image_fill_linesizes(e->linesize, e->format, w)) < 0)
+			return ret;
+		w += w & ~(w - 1);
+
+		unaligned = 0;
+		for (i = 0; i < 4; i++)
+			unaligned |= e->linesize[i] % linesize_align[i];
+	} while (unaligned);
+
+	if ((ret = av_image_fill_pointers(data, e->format, h, NULL, e->linesize)) < 0)
+		return ret;
+	for (i = 0; i < 4; i++)
+		e->offset[i] = (intptr_t)data[i];
+
+	/* the decoders may read a little past the end */
+	e->size = ret + 16 + FRAME_POOL_ALIGN - 1;
+	return 0;
+}
+
+/* under the lock; the pool for this size and format, a new one in place of the oldest if need be */
+static FramePoolEntry *frame_pool_find(AVCodecContext *avctx, FramePool *fp, AVFrame *frame)
+{
+	FramePoolEntry *e = NULL, *lru = &fp->entries[0];
+	int i = 0;
+
+	for (i = 0; i < FRAME_POOL_SIZES && !e; i++) {
+		FramePoolEntry *c = &fp->entries[i];
+		if (c->pool && c->width == frame->width && c->height == frame->height && c->format == frame->format)
+			e = c;
+		else if (lru->pool && (!c->pool || c->last_used < lru->last_used))
+			lru = c;
+	}
+
+	if (!e) {
+		e = lru;
+		av_buffer_pool_uninit(&e->pool);
+
+		e->p = avctx->opaque;
+		e->width = frame->width;
+		e->height = frame->height;
+		e->format = frame->format;
+		if (frame_pool_layout(avctx, e) < 0)
+			return NULL;
+
+		e->pool = av_buffer_pool_init2(e->size, e, frame_pool_alloc, NULL);
+		if (!e->pool)
+			return NULL;
+
+		debug_info("frame pool for %dx%d %s, %d bytes a frame\n",
+			e->width, e->height, av_get_pix_fmt_name(e->format), e->size);
+	}
+	e->last_used = ++fp->uses;
+
+	return e;
+}
+
+static int frame_pool_get_buffer(AVCodecContext *avctx, AVFrame *frame, int flags)
+{
+	Player *p = avctx->opaque;
+	FramePool *fp = p->frame_pool;
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+	FramePoolEntry *e = NULL;
+	AVBufferRef *buf = NULL;
+	uint8_t *data = NULL;
+	int i = 0;
+
+	/* hardware frames and palettes are not ours to lay out */
+	if (!fp || !desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL)))
+		return avcodec_default_get_buffer2(avctx, frame, flags);
+
+	SDL_AtomicLock(&fp->lock);
+	e = frame_pool_find(avctx, fp, frame);
+	if (e)
+		buf = av_buffer_pool_get(e->pool);
+	SDL_AtomicUnlock(&fp->lock);
+
+	if (!e)
+		return avcodec_default_get_buffer2(avctx, frame, flags);
+	if (!buf)
+		return AVERROR(ENOMEM);
+
+	stats_count(p, STATS_FRAME_POOL_GETS);
+
+	data = (uint8_t *)FFALIGN((uintptr_t)buf->data, FRAME_POOL_ALIGN);
+	frame->buf[0] = buf;
+	for (i = 0; i < 4; i++) {
+		frame->data[i] = e->linesize[i] ? data + e->offset[i] : NULL;
+		frame->linesize[i] = e->linesize[i];
+	}
+	frame->extended_data = frame->data;
+
+	return 0;
+}
+
+/* inline */ void frame_pool_attach(Player *p, AVCodecContext *avctx, const AVCodec *codec)
+{
+	if (!p->frame_pool || !(codec->capabilities & AV_CODEC_CAP_DR1))
+		return;
+
+	avctx->opaque = p;
+	avctx->get_buffer2 = frame_pool_get_buffer;
+	/* the pools are locked, frame threads need not wait for the decoding thread to allocate */
+#if !defined(FF_API_THREAD_SAFE_CALLBACKS) || FF_API_THREAD_SAFE_CALLBACKS
+	avctx->thread_safe_callbacks = 1;
+#endif
+}
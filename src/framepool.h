@@ -0,0 +1,20 @@
+#ifndef __FRAMEPOOL_H__
+#define __FRAMEPOOL_H__
+
+#include <libavcodec/avcodec.h>
+
+/*
+ * Decoded pictures come from pools of buffers, one per size and pixel
+ * format, instead of the allocator. The frames move by reference into
+ * the frame queue or the filter graph and the buffers come back to the
+ * pool when the last reference is gone, so a steady stream allocates
+ * nothing after the first few frames, and ABR switches between a few
+ * renditions find their pool still there.
+ */
+int frame_pool_init(Player *p);
+void frame_pool_close(Player *p);
+
+/* before avcodec_open2, only decoders with AV_CODEC_CAP_DR1 use the pool */
+void frame_pool_attach(Player *p, AVCodecContext *avctx, const AVCodec *codec);
+
+#endif
@@ -0,0 +1,162 @@
+#include "frameq.h"
+
+int frame_queue_init(FrameQueue *f, int max_size)
+{
+	int i = 0;
+
+	memset(f, 0, sizeof(FrameQueue));
+	f->max_size = FFMIN(max_size, FRAME_QUEUE_MAX_SIZE);
+
+	for (i = 0; i < f->max_size; i++) {
+		if (!(f->frames[i] = av_frame_alloc())) {
+			return AVERROR(ENOMEM);
+		}
+	}
+
+	f->mutex = SDL_CreateMutex();
+	f->cond = SDL_CreateCond();
+
+	return 0;
+}
+
+void frame_queue_destroy(FrameQueue *f)
+{
+	int i = 0;
+
+	for (i = 0; i < f->max_size; i++) {
+		av_frame_free(&f->frames[i]);
+	}
+
+	SDL_DestroyCond(f->cond);
+	SDL_DestroyMutex(f->mutex);
+	f->cond = NULL;
+	f->mutex = NULL;
+}
+
+void frame_queue_abort(FrameQueue *f)
+{
+	SDL_LockMutex(f->mutex);
+	f->abort_request = 1;
+	SDL_CondSignal(f->cond);
+	SDL_UnlockMutex(f->mutex);
+
+	task_wake(f->producer);
+}
+
+/* wait until there is room for a new frame, NULL if aborted, or without block if full */
+AVFrame *frame_queue_peek_writable(FrameQueue *f, int block)
+{
+	int full = 0;
+
+	SDL_LockMutex(f->mutex);
+
+	while (block && f->size >= f->max_size && !f->abort_request)
+		SDL_CondWait(f->cond, f->mutex);
+	full = f->size >= f->max_size;
+
+	SDL_UnlockMutex(f->mutex);
+
+	if (f->abort_request || full)
+		return NULL;
+
+	return f->frames[f->windex];
+}
+
+void frame_queue_push(FrameQueue *f, int serial, AVRational time_base)
+{
+	f->serials[f->windex] = serial;
+	f->time_bases[f->windex] = time_base;
+
+	if (++f->windex == f->max_size)
+		f->windex = 0;
+
+	SDL_LockMutex(f->mutex);
+	f->size++;
+	SDL_CondSignal(f->cond);
+	SDL_UnlockMutex(f->mutex);
+}
+
+/* the oldest decoded frame, NULL if none is ready */
+AVFrame *frame_queue_peek(FrameQueue *f)
+{
+	int size = 0;
+
+	SDL_LockMutex(f->mutex);
+	size = f->abort_request ? 0 : f->size;
+	SDL_UnlockMutex(f->mutex);
+
+	return size ? f->frames[f->rindex] : NULL;
+}
+
+/* serial of the frame frame_queue_peek returns */
+int frame_queue_peek_serial(FrameQueue *f)
+{
+	return f->serials[f->rindex];
+}
+
+/* reader only: what the pts of a frame it peeked counts in */
+AVRational frame_queue_time_base(FrameQueue *f, const AVFrame *frame)
+{
+	int i = 0;
+
+	for (i = 0; i < f->max_size; i++) {
+		if (f->frames[i] == frame)
+			break;
+	}
+
+	return (i < f->max_size) ? f->time_bases[i] : (AVRational){ 0, 1 };
+}
+
+/* the frame after the oldest one, NULL if there is none */
+AVFrame *frame_queue_peek_next(FrameQueue *f)
+{
+	int size = 0;
+
+	SDL_LockMutex(f->mutex);
+	size = f->abort_request ? 0 : f->size;
+	SDL_UnlockMutex(f->mutex);
+
+	return (size > 1) ? f->frames[(f->rindex + 1) % f->max_size] : NULL;
+}
+
+/* wait up to timeout ms for a frame to be ready, returns the number of ready frames */
+int frame_queue_wait_ready(FrameQueue *f, int timeout)
+{
+	int size = 0;
+
+	SDL_LockMutex(f->mutex);
+
+	if (!f->size && !f->abort_request)
+		SDL_CondWaitTimeout(f->cond, f->mutex, timeout);
+
+	size = f->size;
+	SDL_UnlockMutex(f->mutex);
+
+	return size;
+}
+
+void frame_queue_next(FrameQueue *f)
+{
+	av_frame_unref(f->frames[f->rindex]);
+
+	if (++f->rindex == f->max_size)
+		f->rindex = 0;
+
+	SDL_LockMutex(f->mutex);
+	f->size--;
+	SDL_CondSignal(f->cond);
+	SDL_UnlockMutex(f->mutex);
+
+	task_wake(f->producer);
+}
+
+/* inline */ int frame_queue_nb_frames(FrameQueue *f)
+{
+	int size = 0;
+
+	SDL_LockMutex(f->mutex);
+	size = f->size;
+	SDL_UnlockMutex(f->mutex);
+
+	return size;
+}
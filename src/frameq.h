@@ -0,0 +1,47 @@
+#ifndef __FRAMEQ_H__
+#define __FRAMEQ_H__
+
+#include <libavutil/frame.h>
+#include <SDL2/SDL_mutex.h>
+
+#include "sched.h"
+
+#define FRAME_QUEUE_MAX_SIZE 16
+
+/*
+ * Bounded ring of decoded frames between a decode thread (writer) and the
+ * presentation side (reader). The reader never blocks, the writer blocks
+ * while the queue is full, or if it is a task, is woken once there is room.
+ */
+typedef struct FrameQueue {
+	AVFrame *frames[FRAME_QUEUE_MAX_SIZE];
+	int serials[FRAME_QUEUE_MAX_SIZE];	// serial of the packets each frame came from
+	AVRational time_bases[FRAME_QUEUE_MAX_SIZE];	// of each frame's pts, the filters may change it
+	int rindex;
+	int windex;
+	int size;
+	int max_size;
+	int abort_request;
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+	Task *producer;		// woken when the reader makes room
+} FrameQueue;
+
+#define FRAME_QUEUE_INITIALIZER {{NULL}, {0}}
+
+int frame_queue_init(FrameQueue *f, int max_size);
+void frame_queue_destroy(FrameQueue *f);
+void frame_queue_abort(FrameQueue *f);
+
+AVFrame *frame_queue_peek_writable(FrameQueue *f, int block);
+void frame_queue_push(FrameQueue *f, int serial, AVRational time_base);
+
+AVFrame *frame_queue_peek(FrameQueue *f);
+int frame_queue_peek_serial(FrameQueue *f);
+AVRational frame_queue_time_base(FrameQueue *f, const AVFrame *frame);
+AVFrame *frame_queue_peek_next(FrameQueue *f);
+int frame_queue_wait_ready(FrameQueue *f, int timeout);
+void frame_queue_next(FrameQueue *f);
+int frame_queue_nb_frames(FrameQueue *f);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef __INTERNAL_H__
+#define __INTERNAL_H__
+
+#include <libavformat/avformat.h>
+#include <SDL2/SDL_atomic.h>
+#include <SDL2/SDL_thread.h>
+
+#include "player.h"
+#include "sched.h"
+
+typedef struct VideoState VideoState;
+typedef struct AudioState AudioState;
+typedef struct SubtitleState SubtitleState;
+typedef struct SyncState SyncState;
+typedef struct SeekIndex SeekIndex;
+typedef struct Stats Stats;
+typedef struct ExportState ExportState;
+typedef struct LiveState LiveState;
+typedef struct FramePool FramePool;
+
+/*
+ * What one player owns. Every module keeps its state behind its own
+ * pointer, NULL while that module is not open, and takes the player as
+ * its first argument to get at it and at the other modules.
+ */
+struct Player {
+	PlayerOptions opts;
+	char *url;
+	int headless;		// --bench or --output, see bench.h
+
+	AVFormatContext *fmt_ctx;
+	AVIOContext *io_ctx;
+	Uint32 sdl_flags;	// the SDL subsystems we hold
+	Task *demux_task;
+	AVPacket *demux_pkt;
+	int demux_pending;	// demux_pkt did not fit its queue yet
+	int demux_eof;		// DEMUX_EOF_* markers still to queue, once at the end of file
+	int demux_error;	// the read error the input ended on, 0 if it ended normally
+	int demux_abort;
+	int demuxing;		// player_start, or right after player_open for fast start
+	int started;
+	int paused;
+	double speed;
+	double start_time;	// when we started playing, for the bench report
+	double wall_time;	// how long player_run_headless took
+
+	SDL_SpinLock seek_lock;
+	int seek_req;
+	double seek_target;	// in seconds, on the stream timeline
+	int track_req;		// stream the demuxer switches to, -1 for none
+
+	VideoState *video;
+	AudioState *audio;
+	SubtitleState *subtitle;
+	SyncState *sync;
+	SeekIndex *seek;
+	Stats *stats;
+	ExportState *export;
+	LiveState *live;
+	FramePool *frame_pool;
+};
+
+int open_codec_context(Player *p, int *stream_idx, enum AVMediaType type);
+int open_stream_codec(Player *p, AVStream *st);
+void demux_request_track(Player *p, int index);
+
+#endif
@@ -0,0 +1,198 @@
+#include "config.h"
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#define IO_MMAP 1
+#endif
+
+#include "internal.h"
+#include "debug.h"
+#include "stats.h"
+#include "io.h"
+
+#define IO_BUFFER_SIZE	(256 * 1024)
+#define IO_READAHEAD	(8 * 1024 * 1024)
+/* modified more recently than this, in seconds, the file may still be written */
+#define IO_MMAP_MIN_AGE	10
+
+#ifdef IO_MMAP
+typedef struct MappedFile {
+	uint8_t *data;
+	int64_t size;
+	int64_t pos;
+	int64_t readahead;	// everything below was already advised
+	long page_size;
+	Player *player;		// whose stats the reads count in
+} MappedFile;
+
+/* keep IO_READAHEAD bytes in front of pos on their way in */
+static void io_prefetch(MappedFile *mf)
+{
+	int64_t end = FFMIN(mf->pos + IO_READAHEAD, mf->size);
+	int64_t start = FFMAX(mf->readahead, mf->pos) & ~(int64_t)(mf->page_size - 1);
+
+	/* advise in steps of a quarter window, not on every read */
+	if (end - start < IO_READAHEAD / 4 && end < mf->size)
+		return;
+	if (end <= start)
+		return;
+
+	madvise(mf->data + start, end - start, MADV_WILLNEED);
+	mf->readahead = end;
+}
+
+static int io_read(void *opaque, uint8_t *buf, int buf_size)
+{
+	MappedFile *mf = opaque;
+	int64_t begin = stats_begin();
+	int size = FFMIN(buf_size, mf->size - mf->pos);
+
+	if (size <= 0)
+		return AVERROR_EOF;
+
+	memcpy(buf, mf->data + mf->pos, size);
+	mf->pos += size;
+	io_prefetch(mf);
+
+	stats_end(mf->player, STATS_IO_READ, begin);
+	stats_add_bytes(mf->player, STATS_IO_READ, size);
+
+	return size;
+}
+
+static int64_t io_seek(void *opaque, int64_t offset, int whence)
+{
+	MappedFile *mf = opaque;
+	int64_t pos = 0;
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return mf->size;
+	case SEEK_SET:
+		pos = offset;
+		break;
+	case SEEK_CUR:
+		pos = mf->pos + offset;
+		break;
+	case SEEK_END:
+		pos = mf->size + offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	if (pos < 0 || pos > mf->size)
+		return AVERROR(EINVAL);
+
+	/* the window starts over wherever we land */
+	mf->pos = pos;
+	mf->readahead = pos;
+	io_prefetch(mf);
+
+	return pos;
+}
+#endif
+
+AVIOContext *io_open(Player *p, const char *filename)
+{
+#ifdef IO_MMAP
+	MappedFile *mf = NULL;
+	AVIOContext *pb = NULL;
+	uint8_t *buffer = NULL;
+	struct stat st;
+	const char *path = filename;
+	int fd = -1;
+
+	av_strstart(filename, "file:", &path);
+	if (strstr(path, "://"))
+		return NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		goto fail;
+
+	/* a 32-bit address space can't hold it whole */
+	if ((uint64_t)st.st_size > SIZE_MAX) {
+		debug_info("%s is too large to map, using the default I/O\n", path);
+		goto fail;
+	}
+
+	/* reading a mapping past where the file was cut short is SIGBUS, so files
+	 * that may still be written (or rotated) are read the usual way */
+	if (time(NULL) - st.st_mtime < IO_MMAP_MIN_AGE) {
+		debug_info("%s was just modified, using the default I/O\n", path);
+		goto fail;
+	}
+
+	mf = av_mallocz(sizeof(*mf));
+	if (!mf)
+		goto fail;
+
+	mf->player = p;
+	mf->size = st.st_size;
+	mf->page_size = sysconf(_SC_PAGESIZE);
+	mf->data = mmap(NULL, mf->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mf->data == MAP_FAILED) {
+		debug_info("mmap %s failed, using the default I/O\n", path);
+		mf->data = NULL;
+		goto fail;
+	}
+
+	madvise(mf->data, mf->size, MADV_SEQUENTIAL);
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fd, 0, FFMIN(mf->size, IO_READAHEAD), POSIX_FADV_WILLNEED);
+#endif
+	/* the mapping holds its own reference to the file */
+	close(fd);
+	fd = -1;
+
+	buffer = av_malloc(IO_BUFFER_SIZE);
+	if (!buffer)
+		goto fail;
+
+	pb = avio_alloc_context(buffer, IO_BUFFER_SIZE, 0, mf, io_read, NULL, io_seek);
+	if (!pb)
+		goto fail;
+
+	io_prefetch(mf);
+	debug_info("mapped %s, %"PRId64" bytes\n", path, mf->size);
+	return pb;
+
+fail:
+	av_free(buffer);
+	if (mf && mf->data)
+		munmap(mf->data, mf->size);
+	av_free(mf);
+	if (fd >= 0)
+		close(fd);
+#endif
+	return NULL;
+}
+
+void io_close(AVIOContext **pb)
+{
+	if (!*pb)
+		return;
+
+#ifdef IO_MMAP
+	MappedFile *mf = (*pb)->opaque;
+
+	munmap(mf->data, mf->size);
+	av_free(mf);
+#endif
+	av_freep(&(*pb)->buffer);
+	av_freep(pb);
+}
@@ -0,0 +1,19 @@
+#ifndef __IO_H__
+#define __IO_H__
+
+#include <libavformat/avio.h>
+
+/*
+ * With --mmap, local files are mapped whole and read through a large AVIO
+ * buffer, with the kernel asked to fetch a window ahead of the demuxer, so
+ * slow disks don't cost a syscall per small read. Returns NULL for anything
+ * that is not a regular local file; the caller then lets libavformat open
+ * it the usual way. Off by default: a mapped file that is truncated, or on
+ * a mount that goes away, kills the whole process with SIGBUS, where a read
+ * error would only end one player. Files modified in the last few seconds
+ * are never mapped. The reads show up as io_read in the stats.
+ */
+AVIOContext *io_open(Player *p, const char *filename);
+void io_close(AVIOContext **pb);
+
+#endif
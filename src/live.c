@@ -0,0 +1,212 @@
+#include <math.h>
+#include <string.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/avstring.h>
+#include <libavutil/time.h>
+
+#include "internal.h"
+#include "debug.h"
+#include "clock.h"
+#include "stats.h"
+#include "video.h"
+#include "audio.h"
+#include "live.h"
+
+/* the buffer holds this many times the arrival jitter, and never less than LIVE_MIN_BUFFER */
+#define LIVE_JITTER_FACTOR	3.0
+#define LIVE_MIN_BUFFER		0.1
+/* further than this behind the target we drop instead of catching up, in seconds */
+#define LIVE_DROP_THRESHOLD	0.5
+#define LIVE_CHECK_INTERVAL	0.1
+/* small enough for atempo to keep the pitch and nobody to notice */
+#define LIVE_FAST_RATE		1.1
+#define LIVE_SLOW_RATE		0.95
+
+struct LiveState {
+	double target_max;	// --latency, in seconds
+	double jitter;		// smoothed arrival jitter of the reference stream, in seconds
+	double last_pts;	// newest packet of the reference stream, in seconds
+	double last_arrival;	// when it arrived, see clock_time
+	double next_check;
+	double rate;		// what we asked for last
+	SDL_atomic_t rate_req;	// in 1/1000, for live_refresh to apply, 0 if nothing changed
+	int drop;		// too far behind, drop at the next keyframe
+	double buffered;	// from arrival to presentation, in seconds
+	double latency;		// what we report, in seconds
+};
+
+static const char *live_protocols[] = { "rtsp:", "rtp:", "udp:", "srt:", "rtmp:", NULL };
+
+static int live_alloc(Player *p)
+{
+	LiveState *ls = p->live = av_mallocz(sizeof(LiveState));
+	if (!ls)
+		return AVERROR(ENOMEM);
+
+	ls->target_max = FFMAX(p->opts.latency, 0) / 1000.0;
+	ls->last_pts = NAN;
+	ls->rate = 1.0;
+	ls->buffered = NAN;
+	ls->latency = NAN;
+
+	debug_info("live source, latency target %.0fms\n", ls->target_max * 1000);
+	return 0;
+}
+
+/* before the input is opened, the probing depends on it */
+int live_init(Player *p, const char *url)
+{
+	int live = p->opts.live;
+	int i = 0;
+
+	for (i = 0; !live && live_protocols[i]; i++)
+		live = av_strstart(url, live_protocols[i], NULL);
+
+	return live ? live_alloc(p) : 0;
+}
+
+/*
+ * After the input is opened: an HLS playlist without an end has no
+ * duration, and is played at the edge too, only without the brief probe.
+ */
+int live_detect(Player *p)
+{
+	AVFormatContext *fmt_ctx = p->fmt_ctx;
+
+	if (p->live || fmt_ctx->duration != AV_NOPTS_VALUE)
+		return 0;
+	if (!av_strstart(fmt_ctx->iformat->name, "hls", NULL) &&
+		strcmp(fmt_ctx->iformat->name, "applehttp"))
+		return 0;
+
+	return live_alloc(p);
+}
+
+/* inline */ void live_close(Player *p)
+{
+	av_freep(&p->live);
+}
+
+/* inline */ int live_enabled(Player *p)
+{
+	return p->live != NULL;
+}
+
+static void live_set_rate(Player *p, double rate)
+{
+	LiveState *ls = p->live;
+
+	if (rate == ls->rate)
+		return;
+
+	debug_info("live: %.0fms buffered, jitter %.1fms, playing at %.2fx\n",
+		ls->buffered * 1000, ls->jitter * 1000, rate);
+
+	ls->rate = rate;
+	SDL_AtomicSet(&ls->rate_req, lrint(rate * 1000));
+}
+
+/*
+ * Player thread, from player_refresh: apply the rate the demuxer asked for
+ * where speed changes are applied anyway, the demuxer never touches the
+ * clocks. Only a small correction, so non-reference frames are not skipped
+ * as they are when the user plays fast.
+ */
+void live_refresh(Player *p)
+{
+	LiveState *ls = p->live;
+	int req = ls ? SDL_AtomicSet(&ls->rate_req, 0) : 0;
+
+	if (!req)
+		return;
+
+	sync_set_speed(p, req / 1000.0);
+	if (p->video) video_set_rate(p, req / 1000.0);
+	if (p->audio) audio_set_speed(p, req / 1000.0);
+}
+
+/*
+ * Glass to glass, from the capture to now, when the source tells us its
+ * wall clock (RTCP sender reports); the network and the encoder are in
+ * there, so it is reported, but not what we steer by.
+ */
+static double live_glass_to_glass(Player *p, double clock)
+{
+	AVFormatContext *fmt_ctx = p->fmt_ctx;
+
+	if (fmt_ctx->start_time_realtime <= 0 || fmt_ctx->start_time == AV_NOPTS_VALUE)
+		return NAN;
+
+	return av_gettime() / 1000000.0 - (fmt_ctx->start_time_realtime / 1000000.0 +
+		clock - fmt_ctx->start_time / (double)AV_TIME_BASE);
+}
+
+/* demuxer only, for every packet it reads; 1 if everything queued should be dropped before pkt */
+int live_packet(Player *p, const AVPacket *pkt)
+{
+	LiveState *ls = p->live;
+	int64_t ts = (pkt->pts != AV_NOPTS_VALUE) ? pkt->pts : pkt->dts;
+	double now = clock_time();
+
+	if (!ls)
+		return 0;
+
+	/* the stream the clocks follow, audio if there is any */
+	if (ts != AV_NOPTS_VALUE && (p->audio ? is_audio_packet(p, pkt) : is_video_packet(p, pkt))) {
+		double pts = ts * av_q2d(p->fmt_ctx->streams[pkt->stream_index]->time_base);
+
+		/* RFC 3550 interarrival jitter, skipping timestamp jumps */
+		if (!isnan(ls->last_pts) && fabs(pts - ls->last_pts) < 1.0) {
+			double d = (now - ls->last_arrival) - (pts - ls->last_pts);
+			ls->jitter += (fabs(d) - ls->jitter) / 16;
+		}
+		ls->last_pts = pts;
+		ls->last_arrival = now;
+	}
+
+	/* the decoders can only start over from a keyframe */
+	if (ls->drop && (!p->video || (is_video_packet(p, pkt) && (pkt->flags & AV_PKT_FLAG_KEY)))) {
+		debug_info("live: %.0fms buffered, dropping what is queued\n", ls->buffered * 1000);
+		ls->drop = 0;
+		stats_count(p, STATS_LIVE_DROPS);
+		return 1;
+	}
+
+	if (p->paused || now < ls->next_check)
+		return 0;
+	ls->next_check = now + LIVE_CHECK_INTERVAL;
+
+	/* from when the newest packet arrived to what is heard and seen now */
+	double clock = sync_get_master(p);
+	if (isnan(clock) || isnan(ls->last_pts))
+		return 0;
+	double buffered = ls->last_pts - clock + now - ls->last_arrival;
+	double latency = live_glass_to_glass(p, clock);
+
+	ls->buffered = buffered;
+	ls->latency = isnan(latency) ? buffered : latency;
+	stats_latency(p, ls->latency);
+
+	/* deep enough to ride out the jitter we see, never deeper than asked for */
+	double target = av_clipd(LIVE_JITTER_FACTOR * ls->jitter, LIVE_MIN_BUFFER, FFMAX(ls->target_max, LIVE_MIN_BUFFER));
+
+	if (buffered > target + LIVE_DROP_THRESHOLD)
+		ls->drop = 1;
+
+	if (buffered > target * 1.5)
+		live_set_rate(p, LIVE_FAST_RATE);
+	else if (buffered < target * 0.5)
+		live_set_rate(p, LIVE_SLOW_RATE);
+	else if (fabs(buffered - target) < target * 0.25)
+		live_set_rate(p, 1.0);
+
+	return 0;
+}
+
+/* glass to glass if the source has a wall clock, else from arrival; in seconds,
+ * NAN if the source is not live or nothing has played yet */
+/* inline */ double live_get_latency(Player *p)
+{
+	return p->live ? p->live->latency : NAN;
+}
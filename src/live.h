@@ -0,0 +1,31 @@
+#ifndef __LIVE_H__
+#define __LIVE_H__
+
+#include <libavformat/avformat.h>
+
+/* what a live source is probed with, unless --probesize and --analyzeduration say otherwise */
+#define LIVE_PROBESIZE		500000	// bytes
+#define LIVE_ANALYZEDURATION	500	// ms
+/* how long the RTP demuxer may hold packets back to reorder them, in us */
+#define LIVE_MAX_DELAY		50000
+/* player_refresh comes back at least this often, to apply the rate, in ms */
+#define LIVE_REFRESH_INTERVAL	100
+
+/*
+ * Live sources (RTSP, RTP, UDP, HLS without an end, or --live) are played
+ * at the edge: the packet queues are a jitter buffer sized to the arrival
+ * jitter, up to the --latency target. The demuxer reports every packet here;
+ * playback runs slightly fast while too much is buffered, slightly slow while
+ * too little is, and when it is far behind everything queued is dropped at
+ * the next keyframe.
+ */
+int live_init(Player *p, const char *url);
+int live_detect(Player *p);
+void live_close(Player *p);
+int live_enabled(Player *p);
+
+int live_packet(Player *p, const AVPacket *pkt);
+void live_refresh(Player *p);
+double live_get_latency(Player *p);
+
+#endif
@@ -7,19 +7,16 @@
 #include <SDL2/SDL.h>
 
 #include "debug.h"
-#include "audio.h"
-#include "video.h"
-#include "subtitle.h"
 #include "event.h"
+#include "player.h"
 
 #define ARG_REQ(x) #x":"
 #define ARG_OPT(x) #x"::"
 
-static AVFormatContext *fmt_ctx = NULL;
-static char *vf = NULL;
-static char *af = NULL;
+static char *bench_output = NULL;
+static int list_tracks = 0;
 
-static char* parse_args(int argc, char *argv[])
+static char* parse_args(int argc, char *argv[], PlayerOptions *opts)
 {
 	int opt = 0;
 
@@ -28,6 +25,30 @@ static char* parse_args(int argc, char *argv[])
 		   {"debug-level",  	required_argument, 	NULL, 'd'},  
 		   {"video-filter", 		required_argument, 	NULL, 'V'}, 
 		   {"audio-filter", 		required_argument, 	NULL, 'A'}, 
+		   {"max-queue-size", 	required_argument, 	NULL, 'Q'}, 
+		   {"max-queue-time", 	required_argument, 	NULL, 'T'}, 
+		   {"decode-threads", 	required_argument, 	NULL, 'j'}, 
+		   {"thread-type", 		required_argument, 	NULL, 'J'}, 
+		   {"workers", 			required_argument, 	NULL, 'W'}, 
+		   {"sync", 			required_argument, 	NULL, 's'}, 
+		   {"no-framedrop", 		no_argument, 		NULL, 'D'}, 
+		   {"speed", 			required_argument, 	NULL, 'x'}, 
+		   {"live", 			no_argument, 		NULL, 'L'}, 
+		   {"latency", 			required_argument, 	NULL, 'l'}, 
+		   {"probesize", 		required_argument, 	NULL, 'P'}, 
+		   {"analyzeduration", 	required_argument, 	NULL, 'z'}, 
+		   {"fast-start", 		no_argument, 		NULL, 'f'}, 
+		   {"mmap", 			no_argument, 		NULL, 'M'}, 
+		   {"audio-track", 		required_argument, 	NULL, 'k'}, 
+		   {"subtitle-track", 	required_argument, 	NULL, 'K'}, 
+		   {"list-tracks", 		no_argument, 		NULL, 't'}, 
+		   {"bench", 			optional_argument, 	NULL, 'B'}, 
+		   {"bench-output", 		required_argument, 	NULL, 'o'}, 
+		   {"stats-interval", 	required_argument, 	NULL, 'S'}, 
+		   {"stats-file", 		required_argument, 	NULL, 'F'}, 
+		   {"output", 			required_argument, 	NULL, 'O'}, 
+		   {"video-codec", 		required_argument, 	NULL, 'C'}, 
+		   {"audio-codec", 		required_argument, 	NULL, 'a'}, 
 		   {0, 0, 0, 0}  
 	};
 
@@ -44,12 +65,121 @@ static char* parse_args(int argc, char *argv[])
 			av_log_set_level(atoi(optarg));
 			break;
 		case 'V':
-			vf = optarg;
-			debug_info("set vf=%s\n", vf);
+			opts->video_filter = optarg;
+			debug_info("set vf=%s\n", opts->video_filter);
 			break;
 		case 'A':
-			af = optarg;
-			debug_info("set af=%s\n", af);
+			opts->audio_filter = optarg;
+			debug_info("set af=%s\n", opts->audio_filter);
+			break;
+		case 'Q':
+			opts->max_queue_size = atoi(optarg);
+			debug_info("set max-queue-size=%d\n", opts->max_queue_size);
+			break;
+		case 'T':
+			opts->max_queue_time = atoi(optarg);
+			debug_info("set max-queue-time=%d\n", opts->max_queue_time);
+			break;
+		case 'j':
+			opts->decode_threads = atoi(optarg);
+			debug_info("set decode-threads=%d\n", opts->decode_threads);
+			break;
+		case 'J':
+			if (!strcmp(optarg, "frame")) {
+				opts->decode_thread_type = FF_THREAD_FRAME;
+			} else if (!strcmp(optarg, "slice")) {
+				opts->decode_thread_type = FF_THREAD_SLICE;
+			} else {
+				opts->decode_thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+			}
+			debug_info("set thread-type=%s\n", optarg);
+			break;
+		case 'W':
+			opts->workers = atoi(optarg);
+			debug_info("set workers=%d\n", opts->workers);
+			break;
+		case 's':
+			if (!strcmp(optarg, "video")) {
+				opts->sync = PLAYER_SYNC_VIDEO;
+			} else if (!strcmp(optarg, "ext")) {
+				opts->sync = PLAYER_SYNC_EXTERNAL;
+			} else {
+				opts->sync = PLAYER_SYNC_AUDIO;
+			}
+			debug_info("set sync=%s\n", optarg);
+			break;
+		case 'D':
+			opts->framedrop = 0;
+			debug_info("set framedrop=0\n");
+			break;
+		case 'x':
+			opts->speed = av_clipd(atof(optarg), PLAYER_MIN_SPEED, PLAYER_MAX_SPEED);
+			debug_info("set speed=%.2f\n", opts->speed);
+			break;
+		case 'L':
+			opts->live = 1;
+			debug_info("set live\n");
+			break;
+		case 'l':
+			opts->latency = atoi(optarg);
+			debug_info("set latency=%d\n", opts->latency);
+			break;
+		case 'P':
+			opts->probesize = atoi(optarg);
+			debug_info("set probesize=%d\n", opts->probesize);
+			break;
+		case 'z':
+			opts->analyzeduration = atoi(optarg);
+			debug_info("set analyzeduration=%d\n", opts->analyzeduration);
+			break;
+		case 'f':
+			opts->fast_start = 1;
+			debug_info("set fast-start\n");
+			break;
+		case 'M':
+			opts->use_mmap = 1;
+			debug_info("set mmap\n");
+			break;
+		case 'k':
+			opts->audio_track = optarg;
+			debug_info("set audio-track=%s\n", opts->audio_track);
+			break;
+		case 'K':
+			opts->subtitle_track = optarg;
+			debug_info("set subtitle-track=%s\n", opts->subtitle_track);
+			break;
+		case 't':
+			list_tracks = 1;
+			debug_info("set list-tracks\n");
+			break;
+		case 'B':
+			opts->bench = 1;
+			opts->bench_upload = optarg && !strcmp(optarg, "upload");
+			debug_info("set bench=%s\n", opts->bench_upload ? "upload" : "decode");
+			break;
+		case 'o':
+			bench_output = optarg;
+			debug_info("set bench-output=%s\n", bench_output);
+			break;
+		case 'S':
+			opts->stats_interval = atoi(optarg);
+			debug_info("set stats-interval=%d\n", opts->stats_interval);
+			break;
+		case 'F':
+			opts->stats_file = optarg;
+			debug_info("set stats-file=%s\n", opts->stats_file);
+			break;
+		case 'O':
+			opts->output = optarg;
+			debug_info("set output=%s\n", opts->output);
+			break;
+		case 'C':
+			opts->video_codec = optarg;
+			debug_info("set video-codec=%s\n", opts->video_codec);
+			break;
+		case 'a':
+			opts->audio_codec = optarg;
+			debug_info("set audio-codec=%s\n", opts->audio_codec);
 			break;
 		default:
 			break;
@@ -59,78 +189,49 @@ static char* parse_args(int argc, char *argv[])
 	return argv[optind];
 }
 
-static int sdl_init(Uint32 flags)
-{
-	if(SDL_Init(flags | SDL_INIT_TIMER | SDL_INIT_EVENTS)) {	
-		fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());   
-		return 1;
-	}	
-
-	if (flags & SDL_INIT_VIDEO) {
-		if (sdl_video_init()) {
-			return 1;
-		}
-	}
-
-	if (flags & SDL_INIT_AUDIO) {
-		if (sdl_audio_init()) {
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
-static int demux_thread(void *opaque)
+static void sdl_event_loop(Player *p)
 {
-	/* initialize packet, let the demuxer fill it */
-	AVPacket *pkt = av_packet_alloc();
-	if (!pkt) {
-		fprintf(stderr, "Could not allocate packet\n");
-		return AVERROR(ENOMEM);
-	}
-
-	/* read frames from the file */
-	while (av_read_frame(fmt_ctx, pkt) >= 0) {
-		if(is_video_packet(pkt)) {
-			video_enqueue(pkt);
-		} else if(is_audio_packet(pkt)) {
-			audio_enqueue(pkt);
-		} else if(is_subtitle_packet(pkt)) {
-			subtitle_enqueue(pkt);
-		} else {
-			av_packet_unref(pkt);
-		}
-	}
-
-	debug_info("demux done\n");
-
-	av_packet_free(&pkt);
-	return 0;
-}
-
-static void sdl_event_loop()
-{
-	int thread_pause=0;
-
 	for (;;) {	
 		SDL_Event event;
-		SDL_WaitEvent(&event);
+
+		/* present whatever is due, then sleep until the next frame is,
+		 * a new frame or any other event wakes us up earlier */
+		int timeout = player_refresh(p);
+		if (timeout < 0) {
+			SDL_WaitEvent(&event);
+		} else if (!SDL_WaitEventTimeout(&event, timeout)) {
+			continue;
+		}
 		
 		if(event.type==SDL_KEYDOWN) {	
 			//Pause  
 			if(event.key.keysym.sym==SDLK_SPACE) {
-				thread_pause = !thread_pause;
-				debug_info("%s\n", thread_pause ? "paused" : "playing");
-				if (thread_pause) {
-					video_stop();
-					audio_stop();
-					subtitle_stop();
-				} else {
-					video_start();
-					audio_start();
-					subtitle_start();
-				}
+				if (player_paused(p))
+					player_play(p);
+				else
+					player_pause(p);
+			} else if(event.key.keysym.sym==SDLK_LEFT) {
+				player_seek_relative(p, -10.0);
+			} else if(event.key.keysym.sym==SDLK_RIGHT) {
+				player_seek_relative(p, 10.0);
+			} else if(event.key.keysym.sym==SDLK_DOWN) {
+				player_seek_relative(p, -60.0);
+			} else if(event.key.keysym.sym==SDLK_UP) {
+				player_seek_relative(p, 60.0);
+			} else if(event.key.keysym.sym==SDLK_HOME) {
+				player_seek(p, 0);
+			} else if(event.key.keysym.sym==SDLK_i) {
+				player_toggle_stats_overlay(p);
+			} else if(event.key.keysym.sym==SDLK_RIGHTBRACKET) {
+				player_step_speed(p, 1);
+			} else if(event.key.keysym.sym==SDLK_LEFTBRACKET) {
+				player_step_speed(p, -1);
+			} else if(event.key.keysym.sym==SDLK_BACKSPACE) {
+				player_set_speed(p, 1.0);
+			} else if(event.key.keysym.sym==SDLK_a) {
+				player_cycle_track(p, AVMEDIA_TYPE_AUDIO);
+			} else if(event.key.keysym.sym==SDLK_t) {
+				player_cycle_track(p, AVMEDIA_TYPE_SUBTITLE);
 			}
 		} else if(event.type==SDL_QUIT) {  
 			break;	
@@ -138,14 +239,34 @@ static void sdl_event_loop()
 	}
 }
 
+/* --list-tracks: what --audio-track and --subtitle-track can pick from */
+static void print_tracks(Player *p)
+{
+	PlayerTrack tracks[64];
+	int nb = FFMIN(player_get_tracks(p, tracks, FF_ARRAY_ELEMS(tracks)), FF_ARRAY_ELEMS(tracks));
+	int i = 0;
+
+	for (i = 0; i < nb; i++) {
+		const char *type = av_get_media_type_string(tracks[i].type);
+		printf("%c %3d %-10s %-12s %-4s %s\n", tracks[i].active ? '*' : ' ', tracks[i].index,
+			type ? type : "unknown", tracks[i].codec,
+			tracks[i].language ? tracks[i].language : "und",
+			tracks[i].title ? tracks[i].title : "");
+	}
+}
+
+/* the player is libsmartplayer, all we do is parse the command line and run the event loop */
 int main(int argc, char *argv[])
 {
 	int ret = 0;
 	char *infile = NULL;
+	PlayerOptions opts;
+	Player *p = NULL;
 	
 	debug_info(PACKAGE_STRING"\n");
 
-	infile = parse_args(argc, argv);
+	player_options_default(&opts);
+	infile = parse_args(argc, argv, &opts);
 
 	if (!infile) {
 		fprintf(stderr, "you must provide a input file\n");
@@ -154,116 +275,45 @@ int main(int argc, char *argv[])
 
 	debug_info("the input file is %s\n", infile);
 
-	/* register all formats and codecs */
-	av_register_all();
-	avformat_network_init();
-	avfilter_register_all();
-	avdevice_register_all();
-
-	/* open input file, and allocate format context */
-	if (avformat_open_input(&fmt_ctx, infile, NULL, NULL) < 0) {
-		fprintf(stderr, "Could not open source file %s\n", infile);
+	p = player_create(&opts);
+	if (!p) {
+		fprintf(stderr, "Could not allocate player\n");
 		return 1;
 	}
 
-	/* retrieve stream information */
-	if (avformat_find_stream_info(fmt_ctx, NULL) < 0) {
-		fprintf(stderr, "Could not find stream information\n");
+	if (player_open(p, infile) < 0) {
 		ret = 1;
 		goto end;
 	}
 
-	int video_ok = open_video_codec(fmt_ctx);
-	int audio_ok = open_audio_codec(fmt_ctx);
-	int subtitle_ok = open_subtitle_codec(fmt_ctx);
-
-	/* dump input information to stderr */
-	av_dump_format(fmt_ctx, 0, infile, 0);
-
-	if ((audio_ok < 0 ) && (video_ok < 0)) {
-		fprintf(stderr, "Could not find audio or video stream in the input, aborting\n");
+	if (list_tracks) {
+		print_tracks(p);
+	} else if (opts.bench || opts.output) {
+		player_run_headless(p);
+	} else if (player_play(p) >= 0) {
+		sdl_event_loop(p);
+	} else {
 		ret = 1;
-		goto end;
 	}
 
-	debug_info("Demuxing %s%s%sfrom file '%s'\n",
-		(video_ok < 0) ? "" : "video ",
-		(audio_ok < 0) ? "" : "audio ",
-		(subtitle_ok < 0) ? "" : "subtitle ",
-		infile);
+	if (opts.bench && !list_tracks) {
+		FILE *out = bench_output ? fopen(bench_output, "w") : stdout;
+		if (!out) {
+			fprintf(stderr, "Could not open %s, writing to stdout\n", bench_output);
+			out = stdout;
+		}
 
-	Uint32 sdl_flags = 0;
-	sdl_flags |= (video_ok < 0) ? 0 : SDL_INIT_VIDEO;
-	sdl_flags |= (audio_ok < 0) ? 0 : SDL_INIT_AUDIO;
-	
-	if (sdl_init(sdl_flags)) {
-		fprintf(stderr, "SDL init failed!\n");
-		ret = 1;
-		goto end;
-	}
+		player_bench_report(p, out);
 
-	char args[512];
-	if (vf) {
-		snprintf(args, sizeof(args), "crop=floor(in_w/2)*2:floor(in_h/2)*2,%s", vf);
-	} else {
-		snprintf(args, sizeof(args), "crop=floor(in_w/2)*2:floor(in_h/2)*2");
+		if (out != stdout)
+			fclose(out);
 	}
-	init_video_filters(args);
-
-	SDL_CreateThread(demux_thread,NULL,NULL);
 
-	if (audio_ok >= 0) audio_start();
-	if (video_ok >= 0) video_start();
-	if (subtitle_ok >= 0) subtitle_start();
-
-	sdl_event_loop();
-	
 end:
+	if (player_close(p) < 0)
+		ret = 1;
+	player_free(&p);
 	SDL_Quit();
 
-	close_audio_codec();
-	close_video_codec();
-	close_subtitle_codec();
-	
-	avformat_close_input(&fmt_ctx);
-
 	return ret;
 }
-
-int open_codec_context(int *stream_idx, AVFormatContext *fmt_ctx, enum AVMediaType type)
-{
-    int ret, stream_index;
-    AVStream *st;
-    AVCodecContext *dec_ctx = NULL;
-    AVCodec *dec = NULL;
-
-    ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0);
-    if (ret < 0) {
-        fprintf(stderr, "Could not find %s stream in input file\n",
-                av_get_media_type_string(type));
-        return ret;
-    }
-
-    stream_index = ret;
-    st = fmt_ctx->streams[stream_index];
-
-    /* find decoder for the stream */
-    dec_ctx = st->codec;
-    dec = avcodec_find_decoder(dec_ctx->codec_id);
-    if (!dec) {
-        fprintf(stderr, "Failed to find %s codec\n",
-                av_get_media_type_string(type));
-        return AVERROR(EINVAL);
-    }
-
-    /* Init the decoders */
-    if ((ret = avcodec_open2(dec_ctx, dec, NULL)) < 0) {
-        fprintf(stderr, "Failed to open %s codec\n",
-                av_get_media_type_string(type));
-        return ret;
-    }
-	
-    *stream_idx = stream_index;
-    return 0;
-}
-
@@ -1,66 +1,264 @@
 #include "pktq.h"
 
-void packet_queue_init(PacketQueue *q)
+/* the hard limit, the demuxer stops long before unless the file is badly interleaved */
+#define PACKET_QUEUE_CAPACITY 4096
+/* a queue never has enough with fewer packets than this, as in ffplay */
+#define PACKET_QUEUE_MIN_PACKETS 25
+
+/* enough once max_size bytes or max_duration ms are queued, 0 for no limit, see packet_queue_enough */
+int packet_queue_init(PacketQueue *q, AVRational time_base, int max_size, int max_duration)
 {
 	memset(q, 0, sizeof(PacketQueue));
+
+	q->pkts = av_mallocz_array(PACKET_QUEUE_CAPACITY, sizeof(AVPacket));
+	q->serials = av_mallocz_array(PACKET_QUEUE_CAPACITY, sizeof(int));
+	q->durations = av_mallocz_array(PACKET_QUEUE_CAPACITY, sizeof(int));
+	if (!q->pkts || !q->serials || !q->durations) {
+		av_freep(&q->pkts);
+		av_freep(&q->serials);
+		av_freep(&q->durations);
+		return AVERROR(ENOMEM);
+	}
+
+	q->capacity = PACKET_QUEUE_CAPACITY;
+	q->max_size = max_size;
+	q->max_duration = max_duration;
+	q->time_base = time_base;
 	q->mutex = SDL_CreateMutex();
+	q->cond = SDL_CreateCond();
+
+	return 0;
 }
 
-int packet_queue_put(PacketQueue *q, const AVPacket *pkt)
+void packet_queue_destroy(PacketQueue *q)
 {
-	AVPacketList *pkt1 = av_malloc(sizeof(AVPacketList));
-	if (!pkt1) {
-		return 0;
+	unsigned i = 0;
+
+	if (q->pkts) {
+		for (i = SDL_AtomicGet(&q->rindex); i != SDL_AtomicGet(&q->windex); i++)
+			av_packet_unref(&q->pkts[i & (q->capacity - 1)]);
+	}
+
+	av_freep(&q->pkts);
+	av_freep(&q->serials);
+	av_freep(&q->durations);
+	q->capacity = 0;
+
+	SDL_DestroyCond(q->cond);
+	SDL_DestroyMutex(q->mutex);
+	q->cond = NULL;
+	q->mutex = NULL;
+}
+
+static void packet_queue_wake(PacketQueue *q)
+{
+	if (SDL_AtomicGet(&q->waiters)) {
+		SDL_LockMutex(q->mutex);
+		SDL_CondBroadcast(q->cond);
+		SDL_UnlockMutex(q->mutex);
 	}
+}
 
-	memcpy(&pkt1->pkt, pkt, sizeof(AVPacket));
-	pkt1->next = NULL;
+void packet_queue_abort(PacketQueue *q)
+{
+	SDL_AtomicSet(&q->abort_request, 1);
 
 	SDL_LockMutex(q->mutex);
+	SDL_CondBroadcast(q->cond);
+	SDL_UnlockMutex(q->mutex);
 
-	if (!q->last)
-		q->first = pkt1;
-	else
-		q->last->next = pkt1;
+	task_wake(q->producer);
+	task_wake(q->consumer);
+}
 
-	q->last = pkt1;
-	q->nb_packets++;
-	q->size += pkt1->pkt.size;
-	
+/*
+ * Make a put blocked on a full queue, and any put after it, give up until
+ * the producer flushes. Lets another thread get the demuxer's attention
+ * when it is stuck behind packets that are about to be thrown away.
+ */
+void packet_queue_interrupt(PacketQueue *q)
+{
+	SDL_AtomicSet(&q->interrupt_request, 1);
+
+	SDL_LockMutex(q->mutex);
+	SDL_CondBroadcast(q->cond);
 	SDL_UnlockMutex(q->mutex);
 
-	return 1;
+	task_wake(q->producer);
 }
 
-int packet_queue_get(PacketQueue *q, AVPacket *pkt)
+/* producer only: everything queued so far is stale from now on */
+void packet_queue_flush(PacketQueue *q)
 {
-	int ret = 1;
-	AVPacketList *pkt1 = NULL;
+	SDL_AtomicAdd(&q->serial, 1);
+	SDL_AtomicSet(&q->interrupt_request, 0);
+}
 
+/* producer only: the packets put from now on are in time_base, the queued ones keep their durations */
+/* inline */ void packet_queue_set_time_base(PacketQueue *q, AVRational time_base)
+{
+	q->time_base = time_base;
+}
+
+/* inline */ int packet_queue_nb_packets(PacketQueue *q)
+{
+	return (unsigned)SDL_AtomicGet(&q->windex) - (unsigned)SDL_AtomicGet(&q->rindex);
+}
+
+/* inline */ int packet_queue_size(PacketQueue *q)
+{
+	return SDL_AtomicGet(&q->size);
+}
+
+/* inline */ int packet_queue_aborted(PacketQueue *q)
+{
+	return SDL_AtomicGet(&q->abort_request);
+}
+
+/* inline */ int packet_queue_serial(PacketQueue *q)
+{
+	return SDL_AtomicGet(&q->serial);
+}
+
+static int packet_duration(PacketQueue *q, const AVPacket *pkt)
+{
+	if (pkt->duration <= 0 || !q->time_base.den)
+		return 0;
+
+	return av_rescale_q(pkt->duration, q->time_base, (AVRational){1, 1000});
+}
+
+static int packet_queue_full(PacketQueue *q)
+{
+	int nb_packets = packet_queue_nb_packets(q);
+
+	return nb_packets >= (q->max_packets ? q->max_packets : q->capacity);
+}
+
+/*
+ * Whether the producer could stop reading for this queue: the limits are
+ * not enforced on the put, the demuxer only stops once every queue has
+ * enough, so one stream running ahead in the file never starves another.
+ */
+int packet_queue_enough(PacketQueue *q)
+{
+	if (SDL_AtomicGet(&q->abort_request))
+		return 1;
+	if (q->max_size && SDL_AtomicGet(&q->size) >= q->max_size)
+		return 1;
+
+	return packet_queue_nb_packets(q) > PACKET_QUEUE_MIN_PACKETS &&
+		(!q->max_duration || SDL_AtomicGet(&q->duration) >= q->max_duration);
+}
+
+static int packet_queue_put_blocked(PacketQueue *q)
+{
+	return !SDL_AtomicGet(&q->interrupt_request) && packet_queue_full(q);
+}
+
+static int packet_queue_empty(PacketQueue *q)
+{
+	return !packet_queue_nb_packets(q);
+}
+
+/*
+ * Sleep until cond() turns false. waiters is raised before cond() is
+ * checked again, and the other side bumps its index before it looks at
+ * waiters, so either we see the change or it sees us and signals.
+ */
+static int packet_queue_wait(PacketQueue *q, int (*cond)(PacketQueue *q))
+{
 	SDL_LockMutex(q->mutex);
+	SDL_AtomicAdd(&q->waiters, 1);
 
-	pkt1 = q->first;
-	if (pkt1) {
-		q->first = pkt1->next;
-
-		/* if pkt is the last one, make last NULL so make last safe
-		* because we will free it later
-		*/
-		if (!q->first)
-			q->last = NULL;
-		
-		q->nb_packets--;
-		q->size -= pkt1->pkt.size;
-
-		memcpy(pkt, &pkt1->pkt, sizeof(AVPacket));
-		
-		av_free(pkt1);
-	} else {
-		ret = 0;
-	}
+	while (!SDL_AtomicGet(&q->abort_request) && cond(q))
+		SDL_CondWait(q->cond, q->mutex);
 
+	SDL_AtomicAdd(&q->waiters, -1);
 	SDL_UnlockMutex(q->mutex);
 
-	return ret;
+	return !SDL_AtomicGet(&q->abort_request);
+}
+
+/*
+ * Blocks while the ring is full. Without block returns AVERROR(EAGAIN)
+ * instead and keeps pkt, the next get wakes the producer task. 0 if
+ * refused, pkt is not taken.
+ */
+int packet_queue_put(PacketQueue *q, const AVPacket *pkt, int block)
+{
+	if (SDL_AtomicGet(&q->abort_request) || SDL_AtomicGet(&q->interrupt_request))
+		return 0;
+
+	if (packet_queue_full(q)) {
+		if (!block)
+			return AVERROR(EAGAIN);
+		if (!packet_queue_wait(q, packet_queue_put_blocked))
+			return 0;
+	}
+
+	if (SDL_AtomicGet(&q->interrupt_request))
+		return 0;
+
+	unsigned windex = SDL_AtomicGet(&q->windex) & (q->capacity - 1);
+	memcpy(&q->pkts[windex], pkt, sizeof(AVPacket));
+	q->serials[windex] = SDL_AtomicGet(&q->serial);
+	q->durations[windex] = packet_duration(q, pkt);
+
+	SDL_AtomicAdd(&q->size, pkt->size);
+	SDL_AtomicAdd(&q->duration, q->durations[windex]);
+
+	/* publish the slot, full barrier */
+	SDL_AtomicAdd(&q->windex, 1);
+
+	packet_queue_wake(q);
+	task_wake(q->consumer);
+
+	return 1;
 }
 
+/* consumer only: take the oldest slot out, returns its serial */
+static int packet_queue_pop(PacketQueue *q, AVPacket *pkt)
+{
+	unsigned rindex = SDL_AtomicGet(&q->rindex) & (q->capacity - 1);
+	SDL_MemoryBarrierAcquire();
+	memcpy(pkt, &q->pkts[rindex], sizeof(AVPacket));
+	int serial = q->serials[rindex];
+
+	SDL_AtomicAdd(&q->size, -pkt->size);
+	SDL_AtomicAdd(&q->duration, -q->durations[rindex]);
+
+	/* release the slot, full barrier */
+	SDL_AtomicAdd(&q->rindex, 1);
+
+	/* wake up the producer waiting for room */
+	packet_queue_wake(q);
+	task_wake(q->producer);
+
+	return serial;
+}
+
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block, int *serial)
+{
+	for (;;) {
+		if (SDL_AtomicGet(&q->abort_request))
+			return 0;
+
+		if (packet_queue_empty(q)) {
+			if (!block || !packet_queue_wait(q, packet_queue_empty))
+				return 0;
+			continue;
+		}
+
+		/* queued before the last flush, never hand it out */
+		int pkt_serial = packet_queue_pop(q, pkt);
+		if (pkt_serial != SDL_AtomicGet(&q->serial)) {
+			av_packet_unref(pkt);
+			continue;
+		}
+
+		if (serial)
+			*serial = pkt_serial;
+		return 1;
+	}
+}
@@ -3,18 +3,62 @@
 
 #include <libavformat/avformat.h>
 #include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_atomic.h>
 
+#include "sched.h"
+
+/*
+ * Single producer / single consumer ring of preallocated packet slots.
+ * The demuxer is the only writer of windex and the decoder the only
+ * writer of rindex, so put/get never lock; the mutex and cond are only
+ * touched when one side has to sleep on a full or empty queue.
+ *
+ * Every slot is tagged with the serial it was queued with. Flushing only
+ * bumps the serial from the producer side, the consumer then drops the
+ * stale slots on its next get, so neither side ever moves the other's index.
+ *
+ * When both sides are scheduler tasks, nobody sleeps on the queue: a put
+ * or get that cannot go on returns at once, and the other side wakes the
+ * task up once it has made room or queued something.
+ */
 typedef struct PacketQueue {
-	AVPacketList *first, *last;
-	int nb_packets;
-	int size;
+	AVPacket *pkts;
+	int *serials;		// serial each slot was queued with
+	int *durations;		// in ms, what each slot added to duration
+	int capacity;		// power of two
+	SDL_atomic_t windex;
+	SDL_atomic_t rindex;
+	SDL_atomic_t size;	// in bytes
+	SDL_atomic_t duration;	// in ms
+	int max_packets;	// 0 means capacity
+	int max_size;		// in bytes, 0 means no limit, see packet_queue_enough
+	int max_duration;	// in ms, 0 means no limit
+	AVRational time_base;
+	SDL_atomic_t serial;
+	SDL_atomic_t abort_request;
+	SDL_atomic_t interrupt_request;	// refuse puts until the next flush
+	SDL_atomic_t waiters;
 	SDL_mutex *mutex;
+	SDL_cond *cond;
+	Task *producer;		// woken when a get makes room
+	Task *consumer;		// woken when a put queues something
 } PacketQueue;
 
-#define PACKET_QUEUE_INITIALIZER {NULL, NULL, 0, 0, NULL}
+#define PACKET_QUEUE_INITIALIZER {NULL, 0}
+
+int packet_queue_init(PacketQueue *q, AVRational time_base, int max_size, int max_duration);
+void packet_queue_destroy(PacketQueue *q);
+void packet_queue_abort(PacketQueue *q);
+void packet_queue_interrupt(PacketQueue *q);
+void packet_queue_flush(PacketQueue *q);
+void packet_queue_set_time_base(PacketQueue *q, AVRational time_base);
+int packet_queue_put(PacketQueue *q, const AVPacket *pkt, int block);
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block, int *serial);
 
-void packet_queue_init(PacketQueue *q);
-int packet_queue_put(PacketQueue *q, const AVPacket *pkt);
-int packet_queue_get(PacketQueue *q, AVPacket *pkt);
+int packet_queue_enough(PacketQueue *q);
+int packet_queue_nb_packets(PacketQueue *q);
+int packet_queue_size(PacketQueue *q);
+int packet_queue_aborted(PacketQueue *q);
+int packet_queue_serial(PacketQueue *q);
 
 #endif
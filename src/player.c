@@ -0,0 +1,977 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <math.h>
+
+#include <libavformat/avformat.h>
+#include <libavfilter/avfilter.h>
+#include <libavdevice/avdevice.h>
+#include <libavutil/cpu.h>
+#include <libavutil/avstring.h>
+#include <SDL2/SDL.h>
+
+#include "internal.h"
+#include "debug.h"
+#include "audio.h"
+#include "video.h"
+#include "subtitle.h"
+#include "event.h"
+#include "pktq.h"
+#include "sched.h"
+#include "clock.h"
+#include "seek.h"
+#include "bench.h"
+#include "stats.h"
+#include "io.h"
+#include "export.h"
+#include "live.h"
+#include "framepool.h"
+
+#define DEMUX_EOF_VIDEO	1
+#define DEMUX_EOF_AUDIO	2
+#define DEMUX_EOF	4	// the file ended, the markers are queued or on their way
+
+/* --fast-start probes this much, unless --probesize and --analyzeduration say otherwise */
+#define FAST_START_PROBESIZE		(256 * 1024)
+#define FAST_START_ANALYZEDURATION	100	// ms
+
+/* the steps of player_step_speed */
+static const double speed_steps[] = { 0.25, 0.5, 0.75, 1.0, 1.25, 1.5, 2.0, 3.0, 4.0 };
+
+void player_options_default(PlayerOptions *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->max_queue_size = 15 * 1024 * 1024;
+	opts->max_queue_time = 2000;
+	opts->decode_threads = 0;
+	opts->decode_thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+	opts->sync = PLAYER_SYNC_AUDIO;
+	opts->framedrop = 1;
+	opts->speed = 1.0;
+	opts->latency = 300;
+}
+
+/* the libav* registries are global, whichever player comes first fills them */
+static void player_init_once(void)
+{
+	static SDL_SpinLock lock = 0;
+	static int done = 0;
+
+	SDL_AtomicLock(&lock);
+	if (!done) {
+		/* register all formats and codecs */
+		av_register_all();
+		avformat_network_init();
+		avfilter_register_all();
+		avdevice_register_all();
+		done = 1;
+	}
+	SDL_AtomicUnlock(&lock);
+}
+
+Player *player_create(const PlayerOptions *opts)
+{
+	Player *p = av_mallocz(sizeof(Player));
+	if (!p)
+		return NULL;
+
+	player_init_once();
+
+	if (opts)
+		p->opts = *opts;
+	else
+		player_options_default(&p->opts);
+	p->speed = av_clipd(p->opts.speed, PLAYER_MIN_SPEED, PLAYER_MAX_SPEED);
+	p->track_req = -1;
+
+	if (sched_ref(p->opts.workers) < 0) {
+		fprintf(stderr, "Could not start the worker threads\n");
+		av_freep(&p);
+	}
+
+	return p;
+}
+
+void player_free(Player **p)
+{
+	if (!*p)
+		return;
+
+	player_close(*p);
+	av_freep(p);
+	sched_unref();
+}
+
+/* --audio-track and --subtitle-track: a stream index, or the first stream in that language */
+static int find_track(Player *p, enum AVMediaType type, const char *track)
+{
+    AVFormatContext *fmt_ctx = p->fmt_ctx;
+    char *end = NULL;
+    int i = 0;
+
+    if (!track)
+        return -1;
+
+    i = strtol(track, &end, 10);
+    if (*track && !*end)
+        return (i >= 0 && i < fmt_ctx->nb_streams && fmt_ctx->streams[i]->codec->codec_type == type) ? i : -1;
+
+    for (i = 0; i < fmt_ctx->nb_streams; i++) {
+        AVDictionaryEntry *lang = av_dict_get(fmt_ctx->streams[i]->metadata, "language", NULL, 0);
+        if (fmt_ctx->streams[i]->codec->codec_type == type && lang && !av_strcasecmp(lang->value, track))
+            return i;
+    }
+
+    return -1;
+}
+
+int open_codec_context(Player *p, int *stream_idx, enum AVMediaType type)
+{
+    const char *track = (type == AVMEDIA_TYPE_AUDIO) ? p->opts.audio_track :
+        (type == AVMEDIA_TYPE_SUBTITLE) ? p->opts.subtitle_track : NULL;
+    int ret, wanted = find_track(p, type, track);
+
+    if (track && wanted < 0)
+        fprintf(stderr, "No %s track %s, playing the default one\n",
+                av_get_media_type_string(type), track);
+
+    ret = av_find_best_stream(p->fmt_ctx, type, wanted, -1, NULL, 0);
+    if (ret < 0 && wanted >= 0)
+        ret = av_find_best_stream(p->fmt_ctx, type, -1, -1, NULL, 0);
+    if (ret < 0) {
+        fprintf(stderr, "Could not find %s stream in input file\n",
+                av_get_media_type_string(type));
+        return ret;
+    }
+
+    if ((ret = open_stream_codec(p, p->fmt_ctx->streams[ret])) < 0)
+        return ret;
+
+    *stream_idx = ret;
+    return 0;
+}
+
+/* opens the decoder of st in place, returns the index of st */
+int open_stream_codec(Player *p, AVStream *st)
+{
+    enum AVMediaType type = st->codec->codec_type;
+    AVCodecContext *dec_ctx = NULL;
+    AVCodec *dec = NULL;
+    int ret = 0;
+
+    /* find decoder for the stream */
+    dec_ctx = st->codec;
+    dec = avcodec_find_decoder(dec_ctx->codec_id);
+    if (!dec) {
+        fprintf(stderr, "Failed to find %s codec\n",
+                av_get_media_type_string(type));
+        return AVERROR(EINVAL);
+    }
+
+    /* Init the decoders, with frame and slice threading */
+    dec_ctx->thread_count = p->opts.decode_threads ? p->opts.decode_threads : FFMIN(av_cpu_count() + 1, 16);
+    dec_ctx->thread_type = p->opts.decode_thread_type;
+
+    /* frame threads hold a frame back per thread, live sources can't afford that */
+    if (live_enabled(p)) {
+        dec_ctx->thread_type &= ~FF_THREAD_FRAME;
+        dec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    }
+
+    /* decoded pictures come from our pools, see framepool.h */
+    if (type == AVMEDIA_TYPE_VIDEO)
+        frame_pool_attach(p, dec_ctx, dec);
+
+    if ((ret = avcodec_open2(dec_ctx, dec, NULL)) < 0) {
+        fprintf(stderr, "Failed to open %s codec\n",
+                av_get_media_type_string(type));
+        return ret;
+    }
+
+    debug_info("%s decoder %s opened for stream %d with %d thread(s), type %d\n",
+        av_get_media_type_string(type), dec->name, st->index,
+        dec_ctx->thread_count, dec_ctx->active_thread_type);
+
+    return st->index;
+}
+
+/* only the subsystems this player needs, SDL counts them across players */
+static int sdl_init(Player *p, Uint32 flags)
+{
+	if (!p->sdl_flags)
+		flags |= SDL_INIT_TIMER | SDL_INIT_EVENTS;
+
+	if(SDL_InitSubSystem(flags)) {
+		fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());
+		return 1;
+	}
+	p->sdl_flags |= flags;
+
+	if (flags & SDL_INIT_VIDEO) {
+		if (sdl_video_init(p)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+typedef struct OpenJob {
+	Player *p;
+	int (*open)(Player *p);
+	int (*close)(Player *p);
+	Task *task;
+	int ret;
+} OpenJob;
+
+static int open_job_step(void *opaque)
+{
+	OpenJob *job = opaque;
+
+	job->ret = job->open(job->p);
+	return TASK_DONE;
+}
+
+/* each module allocates its own state, so for fast start they open side
+ * by side on the workers; a codec that fails to open is left out */
+static void open_codecs(Player *p)
+{
+	OpenJob jobs[] = {
+		{ p, open_video_codec, close_video_codec },
+		{ p, open_audio_codec, close_audio_codec },
+		/* subtitles are drawn into our window, there is none in the other modes */
+		{ p, open_subtitle_codec, close_subtitle_codec },
+	};
+	int nb_jobs = (!p->headless && !p->opts.video_cb) ? 3 : 2;
+	int i = 0;
+
+	for (i = 0; i < nb_jobs; i++) {
+		if (p->opts.fast_start)
+			jobs[i].task = task_create("open_codec", open_job_step, &jobs[i]);
+		if (jobs[i].task)
+			task_wake(jobs[i].task);
+		else
+			jobs[i].ret = jobs[i].open(p);
+	}
+
+	for (i = 0; i < nb_jobs; i++) {
+		task_join(jobs[i].task);
+		task_free(&jobs[i].task);
+		if (jobs[i].ret < 0)
+			jobs[i].close(p);
+	}
+}
+
+static int demux_step(void *opaque);
+
+/* the demuxer skips the payload of the tracks nobody decodes */
+static void demux_set_discard(Player *p)
+{
+	int i = 0;
+
+	for (i = 0; i < p->fmt_ctx->nb_streams; i++) {
+		int active = (p->video && i == video_get_stream(p)) ||
+			(p->audio && i == audio_get_stream(p)) ||
+			(p->subtitle && i == subtitle_get_stream(p));
+
+		p->fmt_ctx->streams[i]->discard = active ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+	}
+}
+
+/* a network read never outlasts player_close */
+static int demux_interrupt(void *opaque)
+{
+	Player *p = opaque;
+
+	return p->demux_abort;
+}
+
+int player_open(Player *p, const char *url)
+{
+	AVDictionary *format_opts = NULL;
+	int sync = p->opts.sync;
+	int ret = 0;
+
+	if (p->fmt_ctx) {
+		fprintf(stderr, "Player already open, close it first\n");
+		return -1;
+	}
+
+	p->url = av_strdup(url);
+	if (!p->url || stats_init(p) < 0 || frame_pool_init(p) < 0)
+		return AVERROR(ENOMEM);
+
+	/* no pacing and no audio device, and a window only if we upload;
+	 * exporting runs the same pipeline, the frames go to the encoders */
+	p->headless = p->opts.bench || p->opts.output;
+	if (p->headless) {
+		p->opts.framedrop = 0;
+		if (p->opts.bench_upload)
+			SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+	}
+
+	/* open input file, and allocate format context, reading local files through io.c */
+	p->fmt_ctx = avformat_alloc_context();
+	if (!p->fmt_ctx) {
+		fprintf(stderr, "Could not allocate format context\n");
+		return AVERROR(ENOMEM);
+	}
+	if (p->opts.use_mmap)
+		p->fmt_ctx->pb = p->io_ctx = io_open(p, url);
+	p->fmt_ctx->interrupt_callback.callback = demux_interrupt;
+	p->fmt_ctx->interrupt_callback.opaque = p;
+
+	/* live sources: probe briefly, and hand packets out as soon as they arrive */
+	if (live_init(p, url) < 0)
+		return AVERROR(ENOMEM);
+	if (p->opts.probesize || live_enabled(p) || p->opts.fast_start)
+		av_dict_set_int(&format_opts, "probesize", p->opts.probesize ? p->opts.probesize :
+			live_enabled(p) ? LIVE_PROBESIZE : FAST_START_PROBESIZE, 0);
+	if (p->opts.analyzeduration || live_enabled(p) || p->opts.fast_start)
+		av_dict_set_int(&format_opts, "analyzeduration", (p->opts.analyzeduration ? p->opts.analyzeduration :
+			live_enabled(p) ? LIVE_ANALYZEDURATION : FAST_START_ANALYZEDURATION) * 1000LL, 0);
+	/* the container's frame rate will do */
+	if (p->opts.fast_start)
+		av_dict_set_int(&format_opts, "fpsprobesize", 0, 0);
+	if (live_enabled(p)) {
+		av_dict_set(&format_opts, "fflags", "nobuffer", 0);
+		av_dict_set_int(&format_opts, "max_delay", LIVE_MAX_DELAY, 0);
+	}
+
+	ret = avformat_open_input(&p->fmt_ctx, url, NULL, &format_opts);
+	av_dict_free(&format_opts);
+	if (ret < 0) {
+		fprintf(stderr, "Could not open source file %s\n", url);
+		return -1;
+	}
+
+	/* retrieve stream information */
+	if (avformat_find_stream_info(p->fmt_ctx, NULL) < 0) {
+		fprintf(stderr, "Could not find stream information\n");
+		return -1;
+	}
+	/* before the codecs open, they are set up for low delay */
+	if (live_detect(p) < 0)
+		return AVERROR(ENOMEM);
+
+	/* the codecs hook their queues up to it, player_start wakes it */
+	p->demux_pkt = av_packet_alloc();
+	/* av_read_frame blocks on network input, keep that off the shared workers */
+	p->demux_task = task_create_thread("demux", demux_step, p);
+	if (!p->demux_pkt || !p->demux_task)
+		return AVERROR(ENOMEM);
+
+	open_codecs(p);
+	demux_set_discard(p);
+
+	/* dump input information to stderr */
+	av_dump_format(p->fmt_ctx, 0, url, 0);
+
+	if (!p->video && !p->audio) {
+		fprintf(stderr, "Could not find audio or video stream in the input, aborting\n");
+		return -1;
+	}
+
+	debug_info("Demuxing %s%s%sfrom file '%s'\n",
+		p->video ? "video " : "",
+		p->audio ? "audio " : "",
+		p->subtitle ? "subtitle " : "",
+		url);
+
+	Uint32 sdl_flags = 0;
+	sdl_flags |= (!p->video || p->opts.video_cb || (p->headless && !p->opts.bench_upload)) ? 0 : SDL_INIT_VIDEO;
+	sdl_flags |= (!p->audio || p->headless) ? 0 : SDL_INIT_AUDIO;
+
+	/* the window comes last, see below; the headless modes never open
+	 * the audio device, but still convert for it */
+	if (sdl_init(p, sdl_flags & ~SDL_INIT_VIDEO) || (p->audio && sdl_audio_init(p))) {
+		fprintf(stderr, "SDL init failed!\n");
+		return -1;
+	}
+
+	/* nothing to follow without audio, fall back to the wall clock */
+	if (!p->audio && sync == AV_SYNC_AUDIO_MASTER) {
+		sync = AV_SYNC_EXTERNAL_CLOCK;
+	}
+	if (!p->video && sync == AV_SYNC_VIDEO_MASTER) {
+		sync = AV_SYNC_AUDIO_MASTER;
+	}
+	if (sync_init(p, sync) < 0)
+		return AVERROR(ENOMEM);
+
+	/* the headless modes take frames as fast as they come, speed means nothing
+	 * there; live sources play at the rate they arrive, see live.c */
+	if (!p->headless && !live_enabled(p) && p->speed != 1.0)
+		player_set_speed(p, p->speed);
+
+	if (p->video) init_video_filters(p, p->opts.video_filter);
+	if (p->audio && init_audio_filters(p, p->opts.audio_filter) < 0)
+		return -1;
+	if (seek_index_init(p) < 0)
+		return AVERROR(ENOMEM);
+
+	if (p->opts.output && export_open(p, p->opts.output) < 0)
+		return -1;
+
+	if (stats_start(p, p->opts.stats_interval, p->opts.stats_file) < 0)
+		return -1;
+
+	/* everything the decoders need is there, they fill the queues while the
+	 * window opens, so the first frame is ready when it is */
+	if (p->opts.fast_start) {
+		p->demuxing = 1;
+		task_wake(p->demux_task);
+	}
+
+	if ((sdl_flags & SDL_INIT_VIDEO) && sdl_init(p, SDL_INIT_VIDEO)) {
+		fprintf(stderr, "SDL init failed!\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* any thread: ask the demuxer to seek, target in seconds */
+void player_seek(Player *p, double target)
+{
+	AVFormatContext *fmt_ctx = p->fmt_ctx;
+	double start = (fmt_ctx->start_time != AV_NOPTS_VALUE) ? (double)fmt_ctx->start_time / AV_TIME_BASE : 0;
+
+	/* always at the edge */
+	if (live_enabled(p))
+		return;
+
+	if (fmt_ctx->duration != AV_NOPTS_VALUE)
+		target = FFMIN(target, start + (double)fmt_ctx->duration / AV_TIME_BASE);
+	target = FFMAX(target, start);
+
+	/* the demuxer may sleep on a full queue, wake it up before it can see
+	 * the request, so it never flushes ahead of the interrupt */
+	if (p->video) video_interrupt(p);
+	if (p->audio) audio_interrupt(p);
+	if (p->subtitle) subtitle_interrupt(p);
+
+	SDL_AtomicLock(&p->seek_lock);
+	p->seek_target = target;
+	p->seek_req = 1;
+	SDL_AtomicUnlock(&p->seek_lock);
+
+	task_wake(p->demux_task);
+}
+
+/* relative to what is playing now, or to a seek still pending */
+void player_seek_relative(Player *p, double incr)
+{
+	SDL_AtomicLock(&p->seek_lock);
+	int pending = p->seek_req;
+	double pos = p->seek_target;
+	SDL_AtomicUnlock(&p->seek_lock);
+
+	if (!pending) {
+		double clock = sync_get_master(p);
+		if (!isnan(clock))
+			pos = clock;
+	}
+
+	player_seek(p, pos + incr);
+}
+
+/* play at rate from now on, the clocks go on from where they are */
+void player_set_speed(Player *p, double rate)
+{
+	if (live_enabled(p))
+		return;
+
+	p->speed = av_clipd(rate, PLAYER_MIN_SPEED, PLAYER_MAX_SPEED);
+	debug_info("speed %.2fx\n", p->speed);
+
+	if (!p->sync)
+		return;
+
+	sync_set_speed(p, p->speed);
+	if (p->video) video_set_speed(p, p->speed);
+	if (p->audio) audio_set_speed(p, p->speed);
+}
+
+/* the next step of speed_steps up (dir > 0) or down */
+void player_step_speed(Player *p, int dir)
+{
+	int i = 0;
+
+	if (dir > 0) {
+		for (i = 0; i < FF_ARRAY_ELEMS(speed_steps) - 1 && speed_steps[i] <= p->speed; i++);
+	} else {
+		for (i = FF_ARRAY_ELEMS(speed_steps) - 1; i > 0 && speed_steps[i] >= p->speed; i--);
+	}
+
+	player_set_speed(p, speed_steps[i]);
+}
+
+/* inline */ double player_get_speed(Player *p)
+{
+	return p->speed;
+}
+
+/* live sources only, see live_get_latency */
+/* inline */ double player_get_latency(Player *p)
+{
+	return live_get_latency(p);
+}
+
+/* all the streams of the file, whether or not they are played; returns how
+ * many there are, fills in at most max */
+int player_get_tracks(Player *p, PlayerTrack *tracks, int max)
+{
+	AVFormatContext *fmt_ctx = p->fmt_ctx;
+	int i = 0;
+
+	if (!fmt_ctx)
+		return 0;
+
+	for (i = 0; i < fmt_ctx->nb_streams && i < max; i++) {
+		AVStream *st = fmt_ctx->streams[i];
+		AVDictionaryEntry *lang = av_dict_get(st->metadata, "language", NULL, 0);
+		AVDictionaryEntry *title = av_dict_get(st->metadata, "title", NULL, 0);
+
+		tracks[i].index = i;
+		tracks[i].type = st->codec->codec_type;
+		tracks[i].codec = avcodec_get_name(st->codec->codec_id);
+		tracks[i].language = lang ? lang->value : NULL;
+		tracks[i].title = title ? title->value : NULL;
+		tracks[i].active = (p->video && i == video_get_stream(p)) ||
+			(p->audio && i == audio_get_stream(p)) ||
+			(p->subtitle && i == subtitle_get_stream(p));
+	}
+
+	return fmt_ctx->nb_streams;
+}
+
+/* any thread: the demuxer routes stream index to its decoder from the next packet on */
+void demux_request_track(Player *p, int index)
+{
+	SDL_AtomicLock(&p->seek_lock);
+	p->track_req = index;
+	SDL_AtomicUnlock(&p->seek_lock);
+
+	task_wake(p->demux_task);
+}
+
+/*
+ * Play audio or subtitle track index from now on, without reopening the
+ * file; the demuxer goes back to what is playing, so the new track starts
+ * right away and not after what is queued of the old one. Only the last
+ * of several requests the demuxer did not get to yet counts, so the decoder
+ * is opened by the decoding task that takes the track over, which goes
+ * back to the old track if it does not open; < 0 if there is no decoder.
+ */
+int player_select_track(Player *p, int index)
+{
+	AVFormatContext *fmt_ctx = p->fmt_ctx;
+
+	if (!fmt_ctx || index < 0 || index >= fmt_ctx->nb_streams)
+		return AVERROR(EINVAL);
+
+	AVStream *st = fmt_ctx->streams[index];
+	enum AVMediaType type = st->codec->codec_type;
+	if (!(type == AVMEDIA_TYPE_AUDIO && p->audio) && !(type == AVMEDIA_TYPE_SUBTITLE && p->subtitle)) {
+		fprintf(stderr, "Can not switch to track %d, only audio and subtitles are switched\n", index);
+		return AVERROR(EINVAL);
+	}
+
+	if (!avcodec_find_decoder(st->codec->codec_id)) {
+		fprintf(stderr, "Can not switch to track %d, there is no %s decoder\n",
+			index, avcodec_get_name(st->codec->codec_id));
+		return AVERROR_DECODER_NOT_FOUND;
+	}
+
+	demux_request_track(p, index);
+
+	double pos = player_get_position(p);
+	if (!live_enabled(p) && !isnan(pos))
+		player_seek(p, pos);
+
+	return 0;
+}
+
+/* the next track of type after the one playing, for a key binding */
+void player_cycle_track(Player *p, enum AVMediaType type)
+{
+	AVFormatContext *fmt_ctx = p->fmt_ctx;
+	int cur = -1, i = 0;
+
+	if (type == AVMEDIA_TYPE_AUDIO && p->audio)
+		cur = audio_get_stream(p);
+	else if (type == AVMEDIA_TYPE_SUBTITLE && p->subtitle)
+		cur = subtitle_get_stream(p);
+	if (cur < 0)
+		return;
+
+	for (i = 1; i < fmt_ctx->nb_streams; i++) {
+		AVStream *st = fmt_ctx->streams[(cur + i) % fmt_ctx->nb_streams];
+		if (st->codec->codec_type == type && avcodec_find_decoder(st->codec->codec_id)) {
+			player_select_track(p, st->index);
+			return;
+		}
+	}
+}
+
+/* from player_open to the first video frame presented, in seconds, NAN before */
+/* inline */ double player_get_time_to_first_frame(Player *p)
+{
+	return p->stats ? stats_time_to_first_frame(p) : NAN;
+}
+
+/* in seconds on the stream timeline, NAN before anything played */
+/* inline */ double player_get_position(Player *p)
+{
+	return p->sync ? sync_get_master(p) : NAN;
+}
+
+static void demux_seek(Player *p, double target)
+{
+	int ret = seek_file(p, target);
+
+	/* flush even if the seek failed, the interrupted queues wait for it */
+	if (ret < 0)
+		target = NAN;
+	if (p->video) video_flush(p, target);
+	if (p->audio) audio_flush(p, target);
+	if (p->subtitle) subtitle_flush(p);
+
+	if (ret >= 0)
+		sync_reset(p, target);
+}
+
+/* the audio or subtitle decoder starts over on stream index from the next packet on */
+static void demux_switch_track(Player *p, int index)
+{
+	enum AVMediaType type = p->fmt_ctx->streams[index]->codec->codec_type;
+
+	if (type == AVMEDIA_TYPE_AUDIO && p->audio && index != audio_get_stream(p))
+		audio_switch_stream(p, index);
+	else if (type == AVMEDIA_TYPE_SUBTITLE && p->subtitle && index != subtitle_get_stream(p))
+		subtitle_switch_stream(p, index);
+	else
+		return;
+
+	debug_info("switched to %s track %d\n", av_get_media_type_string(type), index);
+	demux_set_discard(p);
+}
+
+/* live and too far behind: forget what is queued, play on from pkt */
+static void demux_drop(Player *p, const AVPacket *pkt)
+{
+	int64_t ts = (pkt->pts != AV_NOPTS_VALUE) ? pkt->pts : pkt->dts;
+
+	if (p->video) video_flush(p, NAN);
+	if (p->audio) audio_flush(p, NAN);
+	if (p->subtitle) subtitle_flush(p);
+
+	sync_reset(p, (ts == AV_NOPTS_VALUE) ? NAN :
+		ts * av_q2d(p->fmt_ctx->streams[pkt->stream_index]->time_base));
+}
+
+/* hand pkt to its queue, EAGAIN if the queue is full, 0 if nobody took it */
+static int demux_queue(Player *p, AVPacket *pkt)
+{
+	if(p->video && is_video_packet(p, pkt)) {
+		return video_enqueue(p, pkt);
+	} else if(p->audio && is_audio_packet(p, pkt)) {
+		return audio_enqueue(p, pkt);
+	} else if(p->subtitle && is_subtitle_packet(p, pkt)) {
+		return subtitle_enqueue(p, pkt);
+	}
+
+	return 0;
+}
+
+/*
+ * ffplay's rule: stop reading once every stream has enough queued, or all
+ * of them together hold max_queue_size bytes; never while one of them is
+ * still short, or a file with one stream far ahead of the other starves
+ * the other's clock and everything waits on it.
+ */
+static int demux_has_enough(Player *p)
+{
+	int size = 0;
+	int enough = 1;
+
+	if (p->video) enough &= video_queue_enough(p, &size);
+	if (p->audio) enough &= audio_queue_enough(p, &size);
+	if (p->subtitle) enough &= subtitle_queue_enough(p, &size);
+
+	return enough || (p->opts.max_queue_size && size >= p->opts.max_queue_size);
+}
+
+/* queue the end of file markers the decoders did not take yet */
+static int demux_queue_eof(Player *p)
+{
+	if ((p->demux_eof & DEMUX_EOF_VIDEO) && video_eof(p) != AVERROR(EAGAIN))
+		p->demux_eof &= ~DEMUX_EOF_VIDEO;
+	if ((p->demux_eof & DEMUX_EOF_AUDIO) && audio_eof(p) != AVERROR(EAGAIN))
+		p->demux_eof &= ~DEMUX_EOF_AUDIO;
+
+	return TASK_WAIT;
+}
+
+/*
+ * Read one packet from the file per step, and park until a decoder takes
+ * something out once there is enough queued. A queue that is out of slots
+ * keeps the packet in demux_pkt until its decoder makes room.
+ */
+static int demux_step(void *opaque)
+{
+	Player *p = opaque;
+	AVPacket *pkt = p->demux_pkt;
+	int ret = 0;
+
+	if (p->demux_abort)
+		return TASK_DONE;
+	if (!p->demuxing)
+		return TASK_WAIT;
+
+	SDL_AtomicLock(&p->seek_lock);
+	int seek = p->seek_req;
+	double target = p->seek_target;
+	int track = p->track_req;
+	p->seek_req = 0;
+	p->track_req = -1;
+	SDL_AtomicUnlock(&p->seek_lock);
+
+	/* before the seek, so it flushes the new track too */
+	if (track >= 0)
+		demux_switch_track(p, track);
+
+	if (seek) {
+		if (p->demux_pending)
+			av_packet_unref(pkt);
+		p->demux_pending = 0;
+		p->demux_eof = 0;
+		demux_seek(p, target);
+	}
+
+	if (p->demux_pending) {
+		if ((ret = demux_queue(p, pkt)) == AVERROR(EAGAIN))
+			return TASK_WAIT;
+		if (!ret)
+			av_packet_unref(pkt);
+		p->demux_pending = 0;
+	}
+
+	/* stay around, a seek may bring us back */
+	if (p->demux_eof)
+		return demux_queue_eof(p);
+
+	if (demux_has_enough(p))
+		return TASK_WAIT;
+
+	int64_t begin = stats_begin();
+	ret = av_read_frame(p->fmt_ctx, pkt);
+	stats_end(p, STATS_DEMUX, begin);
+
+	/* a read error ends the input like its end does, so the decoders drain */
+	if (ret < 0) {
+		if (p->fmt_ctx->pb && p->fmt_ctx->pb->error) {
+			if (!p->demux_error)
+				fprintf(stderr, "Error reading the input (%s), stopping there\n",
+					av_err2str(p->fmt_ctx->pb->error));
+			p->demux_error = p->fmt_ctx->pb->error;
+		}
+		debug_info("demux done\n");
+		p->demux_eof = DEMUX_EOF | (p->video ? DEMUX_EOF_VIDEO : 0) | (p->audio ? DEMUX_EOF_AUDIO : 0);
+		return demux_queue_eof(p);
+	}
+
+	seek_index_add(p, pkt);
+
+	if (live_packet(p, pkt))
+		demux_drop(p, pkt);
+
+	ret = demux_queue(p, pkt);
+	if (ret == AVERROR(EAGAIN)) {
+		p->demux_pending = 1;
+		return TASK_WAIT;
+	}
+	if (!ret)
+		av_packet_unref(pkt);
+
+	return TASK_AGAIN;
+}
+
+static int player_start(Player *p)
+{
+	p->start_time = clock_time();
+	p->started = 1;
+	p->demuxing = 1;
+	task_wake(p->demux_task);
+
+	return 0;
+}
+
+/* start playing, or resume from pause */
+int player_play(Player *p)
+{
+	if (!p->fmt_ctx || p->headless)
+		return -1;
+
+	if (!p->started) {
+		if (player_start(p) < 0)
+			return -1;
+
+		/* frame threading holds back the first pictures for a few frames,
+		 * don't let the audio clock run away before video catches up */
+		if (p->video) {
+			video_start(p);
+			video_wait_ready(p, 1000);
+		}
+		if (p->audio) audio_start(p);
+		if (p->subtitle) subtitle_start(p);
+		return 0;
+	}
+
+	if (p->paused) {
+		p->paused = 0;
+		debug_info("playing\n");
+		if (p->video) video_start(p);
+		if (p->audio) audio_start(p);
+		sync_set_paused(p, 0);
+	}
+
+	return 0;
+}
+
+void player_pause(Player *p)
+{
+	if (!p->started || p->paused)
+		return;
+
+	p->paused = 1;
+	debug_info("paused\n");
+	if (p->video) video_stop(p);
+	if (p->audio) audio_stop(p);
+	sync_set_paused(p, 1);
+}
+
+/* inline */ int player_paused(Player *p)
+{
+	return p->paused;
+}
+
+/*
+ * Present the frame that is due, on the thread the player was opened on.
+ * Returns how many ms the caller may sleep before the next frame is due,
+ * 0 to be called again right away, -1 to wait for the next USR_VIDEO_EVENT
+ * of this player (event.user.data1); live sources never wait longer than
+ * LIVE_REFRESH_INTERVAL.
+ */
+int player_refresh(Player *p)
+{
+	int timeout = 0;
+
+	if (live_enabled(p))
+		live_refresh(p);
+
+	timeout = p->video ? video_refresh(p) : -1;
+
+	if (live_enabled(p))
+		timeout = (timeout < 0) ? LIVE_REFRESH_INTERVAL : FFMIN(timeout, LIVE_REFRESH_INTERVAL);
+
+	return timeout;
+}
+
+/* inline */ void player_toggle_stats_overlay(Player *p)
+{
+	stats_toggle_overlay(p);
+}
+
+/* --bench and --output: take frames as soon as they are decoded, until both decoders are drained */
+void player_run_headless(Player *p)
+{
+	if (!p->fmt_ctx || !p->headless || player_start(p) < 0)
+		return;
+
+	if (p->video) video_start(p);
+	if (p->audio) audio_start(p);
+
+	for (;;) {
+		int busy = 0;
+
+		if (p->video) busy |= video_bench_step(p);
+		if (p->audio) busy |= audio_bench_step(p);
+
+		if ((!p->video || video_bench_done(p)) && (!p->audio || audio_bench_done(p)))
+			break;
+
+		/* the decoders are behind, don't spin */
+		if (!busy)
+			SDL_Delay(1);
+	}
+
+	p->wall_time = clock_time() - p->start_time;
+
+	if (p->demux_error)
+		fprintf(stderr, "The input ended on a read error, %s covers only what was read\n",
+			p->opts.output ? "the output" : "the benchmark");
+}
+
+void player_bench_report(Player *p, FILE *out)
+{
+	AVFormatContext *fmt_ctx = p->fmt_ctx;
+	double media_time = (fmt_ctx->duration != AV_NOPTS_VALUE) ? (double)fmt_ctx->duration / AV_TIME_BASE : 0;
+
+	bench_report(p, out, p->url, p->wall_time, media_time);
+}
+
+/* stops everything and releases what player_open got, returns < 0 if the
+ * output could not be finished or the input could not be read to its end */
+int player_close(Player *p)
+{
+	int ret = 0;
+
+	/* the demuxer and the decoders see this on their next step */
+	p->demux_abort = 1;
+	if (p->video) video_abort(p);
+	if (p->audio) audio_abort(p);
+	if (p->subtitle) subtitle_abort(p);
+	task_join(p->demux_task);
+
+	if (export_close(p) < 0 || p->demux_error)
+		ret = -1;
+	if (p->stats)
+		stats_stop(p);
+
+	close_audio_codec(p);
+	close_video_codec(p);
+	close_subtitle_codec(p);
+	frame_pool_close(p);
+	/* the decoders are gone, nothing wakes it any more */
+	task_free(&p->demux_task);
+	if (p->demux_pending)
+		av_packet_unref(p->demux_pkt);
+	av_packet_free(&p->demux_pkt);
+	seek_index_destroy(p);
+	sync_close(p);
+	live_close(p);
+
+	avformat_close_input(&p->fmt_ctx);
+	io_close(&p->io_ctx);
+
+	if (p->sdl_flags) {
+		SDL_QuitSubSystem(p->sdl_flags);
+		p->sdl_flags = 0;
+	}
+
+	stats_free(p);
+	av_freep(&p->url);
+	p->demux_abort = 0;
+	p->demux_pending = 0;
+	p->demux_eof = 0;
+	p->demux_error = 0;
+	p->demuxing = 0;
+	p->track_req = -1;
+	p->started = 0;
+	p->paused = 0;
+	p->headless = 0;
+
+	return ret;
+}
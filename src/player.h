@@ -0,0 +1,105 @@
+#ifndef __PLAYER_H__
+#define __PLAYER_H__
+
+#include <stdio.h>
+
+#include <libavutil/frame.h>
+
+/*
+ * libsmartplayer: any number of players in one process, each with its own
+ * demuxer, decoders, clocks and stats. Call everything but the callbacks
+ * from one thread per player, the one the player was opened on.
+ */
+typedef struct Player Player;
+
+/* a frame that is due now, only valid until the callback returns */
+enum {
+	PLAYER_SYNC_AUDIO,	// the other streams follow the audio device
+	PLAYER_SYNC_VIDEO,
+	PLAYER_SYNC_EXTERNAL,	// everything follows the wall clock
+};
+
+typedef void (*PlayerVideoCallback)(void *opaque, const AVFrame *frame, double pts);
+
+typedef struct PlayerOptions {
+	const char *video_filter;	// libavfilter chain, NULL for none
+	const char *audio_filter;
+	int max_queue_size;		// all packet queues together, in bytes
+	int max_queue_time;		// a packet queue has enough with this much, in ms
+	int decode_threads;		// 0 means one per core
+	int decode_thread_type;		// FF_THREAD_FRAME and/or FF_THREAD_SLICE
+	int workers;			// the pool all players share, the first player sizes it, 0 means one per core
+	int sync;			// PLAYER_SYNC_*
+	int framedrop;
+	double speed;			// PLAYER_MIN_SPEED to PLAYER_MAX_SPEED
+
+	/* live: RTSP, RTP, UDP, SRT, RTMP and HLS without an end always are, anything else if asked */
+	int live;
+	int latency;			// live: most the jitter buffer may hold, in ms
+	int probesize;			// in bytes, 0 for the default, small for live sources
+	int analyzeduration;		// in ms, likewise
+	int fast_start;			// probe less, open the codecs side by side, decode while the window opens
+	int use_mmap;			// map local files that will not change while playing, see io.h
+	const char *audio_track;	// a stream index or a language, NULL for the best one
+	const char *subtitle_track;
+
+	/* headless: frames are taken as soon as they are decoded, see player_run_headless */
+	int bench;
+	int bench_upload;		// --bench: still upload to a hidden window
+	const char *output;		// encode into this file instead of playing
+	const char *video_codec;	// encoder names, the output format picks if NULL
+	const char *audio_codec;
+
+	int stats_interval;		// in seconds, 0 means no periodic dump
+	const char *stats_file;
+
+	/* present through this instead of a window of our own, no subtitles then */
+	PlayerVideoCallback video_cb;
+	void *opaque;
+} PlayerOptions;
+
+/* a stream of the file, see player_get_tracks */
+typedef struct PlayerTrack {
+	int index;			// what player_select_track takes
+	enum AVMediaType type;
+	const char *codec;
+	const char *language;		// NULL if the file does not say
+	const char *title;
+	int active;			// being decoded
+} PlayerTrack;
+
+#define PLAYER_MIN_SPEED 0.25
+#define PLAYER_MAX_SPEED 4.0
+
+void player_options_default(PlayerOptions *opts);
+
+Player *player_create(const PlayerOptions *opts);
+void player_free(Player **p);
+
+int player_open(Player *p, const char *url);
+int player_close(Player *p);
+
+int player_play(Player *p);
+void player_pause(Player *p);
+int player_paused(Player *p);
+
+void player_seek(Player *p, double target);
+void player_seek_relative(Player *p, double incr);
+void player_set_speed(Player *p, double speed);
+void player_step_speed(Player *p, int dir);
+double player_get_speed(Player *p);
+double player_get_position(Player *p);
+double player_get_latency(Player *p);
+double player_get_time_to_first_frame(Player *p);
+
+int player_get_tracks(Player *p, PlayerTrack *tracks, int max);
+int player_select_track(Player *p, int index);
+void player_cycle_track(Player *p, enum AVMediaType type);
+
+int player_refresh(Player *p);
+void player_toggle_stats_overlay(Player *p);
+
+void player_run_headless(Player *p);
+void player_bench_report(Player *p, FILE *out);
+
+#endif
@@ -0,0 +1,136 @@
+#include <libavutil/mem.h>
+#include <libavutil/common.h>
+
+#include "ringbuf.h"
+
+int ring_buffer_init(RingBuffer *r, unsigned size)
+{
+	memset(r, 0, sizeof(RingBuffer));
+
+	/* round up to a power of two so wrapping is a mask */
+	r->size = 1;
+	while (r->size < size)
+		r->size <<= 1;
+
+	r->data = av_malloc(r->size);
+	if (!r->data) {
+		return AVERROR(ENOMEM);
+	}
+
+	r->mutex = SDL_CreateMutex();
+	r->cond = SDL_CreateCond();
+
+	return 0;
+}
+
+void ring_buffer_destroy(RingBuffer *r)
+{
+	av_freep(&r->data);
+	r->size = 0;
+
+	SDL_DestroyCond(r->cond);
+	SDL_DestroyMutex(r->mutex);
+	r->cond = NULL;
+	r->mutex = NULL;
+}
+
+void ring_buffer_abort(RingBuffer *r)
+{
+	SDL_AtomicSet(&r->abort_request, 1);
+
+	SDL_LockMutex(r->mutex);
+	SDL_CondBroadcast(r->cond);
+	SDL_UnlockMutex(r->mutex);
+
+	task_wake(r->producer);
+}
+
+/* inline */ unsigned ring_buffer_fill(RingBuffer *r)
+{
+	return (unsigned)SDL_AtomicGet(&r->windex) - (unsigned)SDL_AtomicGet(&r->rindex);
+}
+
+/* room for the writer right now, 0 once aborted */
+/* inline */ unsigned ring_buffer_space(RingBuffer *r)
+{
+	return SDL_AtomicGet(&r->abort_request) ? 0 : r->size - ring_buffer_fill(r);
+}
+
+/* same handshake as the packet queue, see packet_queue_wait */
+int ring_buffer_wait_space(RingBuffer *r, unsigned len)
+{
+	len = FFMIN(len, r->size);
+
+	if (r->size - ring_buffer_fill(r) >= len)
+		return !SDL_AtomicGet(&r->abort_request);
+
+	SDL_LockMutex(r->mutex);
+	SDL_AtomicAdd(&r->waiters, 1);
+
+	while (!SDL_AtomicGet(&r->abort_request) && r->size - ring_buffer_fill(r) < len)
+		SDL_CondWait(r->cond, r->mutex);
+
+	SDL_AtomicAdd(&r->waiters, -1);
+	SDL_UnlockMutex(r->mutex);
+
+	return !SDL_AtomicGet(&r->abort_request);
+}
+
+/* len must fit, see ring_buffer_wait_space */
+void ring_buffer_copy_in(RingBuffer *r, const uint8_t *buf, unsigned len)
+{
+	unsigned windex = SDL_AtomicGet(&r->windex) & (r->size - 1);
+	unsigned first = FFMIN(len, r->size - windex);
+
+	memcpy(r->data + windex, buf, first);
+	memcpy(r->data, buf + first, len - first);
+}
+
+void ring_buffer_commit(RingBuffer *r, unsigned len)
+{
+	/* publish the data, full barrier */
+	SDL_AtomicAdd(&r->windex, len);
+}
+
+static void ring_buffer_wake(RingBuffer *r)
+{
+	if (SDL_AtomicGet(&r->waiters)) {
+		SDL_LockMutex(r->mutex);
+		SDL_CondSignal(r->cond);
+		SDL_UnlockMutex(r->mutex);
+	}
+
+	task_wake(r->producer);
+}
+
+unsigned ring_buffer_read(RingBuffer *r, uint8_t *buf, unsigned len)
+{
+	unsigned rindex = 0, first = 0;
+
+	len = FFMIN(len, ring_buffer_fill(r));
+	if (!len)
+		return 0;
+
+	SDL_MemoryBarrierAcquire();
+
+	rindex = SDL_AtomicGet(&r->rindex) & (r->size - 1);
+	first = FFMIN(len, r->size - rindex);
+
+	memcpy(buf, r->data + rindex, first);
+	memcpy(buf + first, r->data, len - first);
+
+	/* release the room, full barrier */
+	SDL_AtomicAdd(&r->rindex, len);
+
+	ring_buffer_wake(r);
+
+	return len;
+}
+
+/* drop everything buffered, only the reader or whoever keeps it out may call this */
+void ring_buffer_flush(RingBuffer *r)
+{
+	SDL_AtomicSet(&r->rindex, SDL_AtomicGet(&r->windex));
+
+	ring_buffer_wake(r);
+}
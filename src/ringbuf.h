@@ -0,0 +1,44 @@
+#ifndef __RINGBUF_H__
+#define __RINGBUF_H__
+
+#include <stdint.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_atomic.h>
+
+#include "sched.h"
+
+/*
+ * Single producer / single consumer byte ring. rindex and windex only
+ * grow, the reader never blocks and the writer waits for room, then
+ * copies in and commits, so the reader never sees half written data.
+ * A writer that is a task does not wait, it writes what ring_buffer_space
+ * allows and is woken by the next read.
+ */
+typedef struct RingBuffer {
+	uint8_t *data;
+	unsigned size;		// power of two
+	SDL_atomic_t windex;
+	SDL_atomic_t rindex;
+	SDL_atomic_t abort_request;
+	SDL_atomic_t waiters;
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+	Task *producer;		// woken when a read makes room
+} RingBuffer;
+
+#define RING_BUFFER_INITIALIZER {NULL, 0}
+
+int ring_buffer_init(RingBuffer *r, unsigned size);
+void ring_buffer_destroy(RingBuffer *r);
+void ring_buffer_abort(RingBuffer *r);
+
+int ring_buffer_wait_space(RingBuffer *r, unsigned len);
+unsigned ring_buffer_space(RingBuffer *r);
+void ring_buffer_copy_in(RingBuffer *r, const uint8_t *buf, unsigned len);
+void ring_buffer_commit(RingBuffer *r, unsigned len);
+
+unsigned ring_buffer_read(RingBuffer *r, uint8_t *buf, unsigned len);
+void ring_buffer_flush(RingBuffer *r);
+unsigned ring_buffer_fill(RingBuffer *r);
+
+#endif
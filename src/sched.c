@@ -0,0 +1,401 @@
+#include "config.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/cpu.h>
+#include <libavutil/common.h>
+#include <SDL2/SDL.h>
+
+#include "debug.h"
+#include "sched.h"
+
+#define SCHED_MAX_WORKERS 64
+
+enum {
+	TASK_PARKED,	// waiting for task_wake
+	TASK_QUEUED,	// in a worker deque
+	TASK_RUNNING,
+	TASK_FINISHED,
+};
+
+struct Task {
+	const char *name;
+	TaskFunc func;
+	void *opaque;
+	SDL_SpinLock lock;	// guards state and woken
+	int state;
+	int woken;		// woken while running, don't park it
+	struct Task *prev, *next;	// in a worker deque
+	SDL_Thread *tid;	// task_create_thread: runs here and not on the pool
+	SDL_mutex *mutex;	// and sleeps on cond while parked
+	SDL_cond *cond;
+};
+
+/* the owner takes from the head, so its tasks take turns; thieves take from the tail */
+typedef struct Worker {
+	SDL_Thread *tid;
+	SDL_SpinLock lock;
+	Task *head, *tail;
+	int index;
+} Worker;
+
+static SDL_mutex *setup_mutex = NULL;	// guards sched_refs and the setup, see sched_setup_lock
+static int sched_refs = 0;
+static int nb_workers = 0;
+static Worker workers[SCHED_MAX_WORKERS];
+static SDL_atomic_t nb_queued;	// in all the deques
+static SDL_atomic_t nb_idle;	// workers asleep on idle_cond
+static SDL_atomic_t next_worker;	// where wakes from outside the pool go
+static SDL_atomic_t quit;
+static SDL_mutex *sched_mutex = NULL;
+static SDL_cond *idle_cond = NULL;
+static SDL_cond *done_cond = NULL;	// task_join waits here
+
+static void deque_push(Worker *w, Task *t)
+{
+	SDL_AtomicLock(&w->lock);
+	t->next = NULL;
+	t->prev = w->tail;
+	if (w->tail)
+		w->tail->next = t;
+	else
+		w->head = t;
+	w->tail = t;
+	SDL_AtomicUnlock(&w->lock);
+
+	SDL_AtomicAdd(&nb_queued, 1);
+}
+
+static Task *deque_take(Worker *w, int steal)
+{
+	Task *t = NULL;
+
+	SDL_AtomicLock(&w->lock);
+	t = steal ? w->tail : w->head;
+	if (t) {
+		if (t->prev)
+			t->prev->next = t->next;
+		else
+			w->head = t->next;
+		if (t->next)
+			t->next->prev = t->prev;
+		else
+			w->tail = t->prev;
+		t->prev = t->next = NULL;
+	}
+	SDL_AtomicUnlock(&w->lock);
+
+	if (t)
+		SDL_AtomicAdd(&nb_queued, -1);
+	return t;
+}
+
+/* same handshake as the packet queue: queued is raised before idle is read,
+ * idle before queued is, so either the sleeper sees the task or we see it */
+static void sched_notify(void)
+{
+	if (SDL_AtomicGet(&nb_idle)) {
+		SDL_LockMutex(sched_mutex);
+		SDL_CondSignal(idle_cond);
+		SDL_UnlockMutex(sched_mutex);
+	}
+}
+
+static Task *sched_take(Worker *w)
+{
+	Task *t = deque_take(w, 0);
+	int i = 0;
+
+	for (i = 1; !t && i < nb_workers; i++)
+		t = deque_take(&workers[(w->index + i) % nb_workers], 1);
+
+	return t;
+}
+
+/* w is NULL for a task on its own thread, it just goes round again */
+static void task_run(Worker *w, Task *t)
+{
+	int ret = 0, queued = 0;
+
+	SDL_AtomicLock(&t->lock);
+	t->state = TASK_RUNNING;
+	t->woken = 0;
+	SDL_AtomicUnlock(&t->lock);
+
+	ret = t->func(t->opaque);
+
+	SDL_AtomicLock(&t->lock);
+	if (ret == TASK_DONE) {
+		t->state = TASK_FINISHED;
+	} else if (ret == TASK_AGAIN || t->woken) {
+		t->state = TASK_QUEUED;
+		if (w) {
+			deque_push(w, t);
+			queued = 1;
+		}
+	} else {
+		t->state = TASK_PARKED;
+	}
+	SDL_AtomicUnlock(&t->lock);
+
+	if (ret == TASK_DONE) {
+		SDL_LockMutex(sched_mutex);
+		SDL_CondBroadcast(done_cond);
+		SDL_UnlockMutex(sched_mutex);
+	} else if (queued) {
+		sched_notify();
+	}
+}
+
+static int worker_thread(void *opaque)
+{
+	Worker *w = opaque;
+
+	while (!SDL_AtomicGet(&quit)) {
+		Task *t = sched_take(w);
+		if (t) {
+			task_run(w, t);
+			continue;
+		}
+
+		SDL_LockMutex(sched_mutex);
+		SDL_AtomicAdd(&nb_idle, 1);
+		while (!SDL_AtomicGet(&nb_queued) && !SDL_AtomicGet(&quit))
+			SDL_CondWait(idle_cond, sched_mutex);
+		SDL_AtomicAdd(&nb_idle, -1);
+		SDL_UnlockMutex(sched_mutex);
+	}
+
+	return 0;
+}
+
+static int task_thread(void *opaque)
+{
+	Task *t = opaque;
+	int state = 0;
+
+	do {
+		SDL_LockMutex(t->mutex);
+		for (;;) {
+			SDL_AtomicLock(&t->lock);
+			state = t->state;
+			SDL_AtomicUnlock(&t->lock);
+			if (state != TASK_PARKED)
+				break;
+			SDL_CondWait(t->cond, t->mutex);
+		}
+		SDL_UnlockMutex(t->mutex);
+
+		task_run(NULL, t);
+
+		SDL_AtomicLock(&t->lock);
+		state = t->state;
+		SDL_AtomicUnlock(&t->lock);
+	} while (state != TASK_FINISHED);
+
+	return 0;
+}
+
+static void sched_stop(void)
+{
+	int i = 0;
+
+	SDL_AtomicSet(&quit, 1);
+	if (sched_mutex) {
+		SDL_LockMutex(sched_mutex);
+		SDL_CondBroadcast(idle_cond);
+		SDL_UnlockMutex(sched_mutex);
+	}
+
+	for (i = 0; i < nb_workers; i++) {
+		if (workers[i].tid)
+			SDL_WaitThread(workers[i].tid, NULL);
+		workers[i].tid = NULL;
+	}
+	nb_workers = 0;
+
+	SDL_DestroyCond(done_cond);
+	SDL_DestroyCond(idle_cond);
+	SDL_DestroyMutex(sched_mutex);
+	done_cond = idle_cond = NULL;
+	sched_mutex = NULL;
+}
+
+static int sched_start(int count)
+{
+	int i = 0;
+
+	SDL_AtomicSet(&quit, 0);
+	sched_mutex = SDL_CreateMutex();
+	idle_cond = SDL_CreateCond();
+	done_cond = SDL_CreateCond();
+	if (!sched_mutex || !idle_cond || !done_cond)
+		return AVERROR(ENOMEM);
+
+	nb_workers = av_clip(count > 0 ? count : av_cpu_count(), 1, SCHED_MAX_WORKERS);
+	for (i = 0; i < nb_workers; i++) {
+		memset(&workers[i], 0, sizeof(Worker));
+		workers[i].index = i;
+	}
+
+	/* all the deques exist before any worker may steal from them */
+	for (i = 0; i < nb_workers; i++) {
+		workers[i].tid = SDL_CreateThread(worker_thread, "sched_worker", &workers[i]);
+		if (!workers[i].tid) {
+			fprintf(stderr, "SDL_CreateThread: %s\n", SDL_GetError());
+			return -1;
+		}
+	}
+
+	debug_info("scheduler started with %d worker(s)\n", nb_workers);
+	return 0;
+}
+
+/* starting and stopping the workers takes a while, others opening or
+ * closing a player sleep meanwhile; created once, kept for the process */
+static SDL_mutex *sched_setup_lock(void)
+{
+	static SDL_SpinLock lock = 0;
+
+	SDL_AtomicLock(&lock);
+	if (!setup_mutex)
+		setup_mutex = SDL_CreateMutex();
+	SDL_AtomicUnlock(&lock);
+
+	if (setup_mutex)
+		SDL_LockMutex(setup_mutex);
+	return setup_mutex;
+}
+
+/* the first player sizes the pool, 0 means one worker per core; the last one stops it */
+int sched_ref(int count)
+{
+	int ret = 0;
+
+	if (!sched_setup_lock())
+		return AVERROR(ENOMEM);
+
+	if (!sched_refs && (ret = sched_start(count)) < 0)
+		sched_stop();
+	else
+		sched_refs++;
+	SDL_UnlockMutex(setup_mutex);
+
+	return ret;
+}
+
+void sched_unref(void)
+{
+	if (!sched_setup_lock())
+		return;
+
+	if (sched_refs && !--sched_refs)
+		sched_stop();
+	SDL_UnlockMutex(setup_mutex);
+}
+
+/* parked until the first task_wake */
+Task *task_create(const char *name, TaskFunc func, void *opaque)
+{
+	Task *t = av_mallocz(sizeof(Task));
+	if (!t)
+		return NULL;
+
+	t->name = name;
+	t->func = func;
+	t->opaque = opaque;
+	t->state = TASK_PARKED;
+
+	return t;
+}
+
+/*
+ * For a task that blocks, on network reads say: it gets a thread of its
+ * own, so it never holds a worker the other players' tasks need, and is
+ * woken and joined like any other. The scheduler must be running.
+ */
+Task *task_create_thread(const char *name, TaskFunc func, void *opaque)
+{
+	Task *t = task_create(name, func, opaque);
+	if (!t)
+		return NULL;
+
+	t->mutex = SDL_CreateMutex();
+	t->cond = SDL_CreateCond();
+	if (t->mutex && t->cond)
+		t->tid = SDL_CreateThread(task_thread, name, t);
+	if (!t->tid) {
+		fprintf(stderr, "SDL_CreateThread: %s\n", SDL_GetError());
+		task_free(&t);
+	}
+
+	return t;
+}
+
+/* any thread: run t soon, or once more if it is running right now */
+void task_wake(Task *t)
+{
+	int queued = 0;
+
+	if (!t)
+		return;
+
+	SDL_AtomicLock(&t->lock);
+	if (t->state == TASK_PARKED) {
+		t->state = TASK_QUEUED;
+		if (!t->tid)
+			deque_push(&workers[(unsigned)SDL_AtomicAdd(&next_worker, 1) % nb_workers], t);
+		queued = 1;
+	} else if (t->state == TASK_RUNNING) {
+		t->woken = 1;
+	}
+	SDL_AtomicUnlock(&t->lock);
+
+	if (queued && t->tid) {
+		SDL_LockMutex(t->mutex);
+		SDL_CondSignal(t->cond);
+		SDL_UnlockMutex(t->mutex);
+	} else if (queued) {
+		sched_notify();
+	}
+}
+
+/*
+ * Wake the task so it sees whatever it was told to stop on, and wait
+ * until it returns TASK_DONE. Its func must get there on its own.
+ */
+void task_join(Task *t)
+{
+	int state = 0;
+
+	if (!t)
+		return;
+
+	task_wake(t);
+
+	SDL_LockMutex(sched_mutex);
+	for (;;) {
+		SDL_AtomicLock(&t->lock);
+		state = t->state;
+		SDL_AtomicUnlock(&t->lock);
+		if (state == TASK_FINISHED)
+			break;
+		SDL_CondWait(done_cond, sched_mutex);
+	}
+	SDL_UnlockMutex(sched_mutex);
+
+	if (t->tid)
+		SDL_WaitThread(t->tid, NULL);
+	t->tid = NULL;
+
+	debug_info("task %s done\n", t->name);
+}
+
+/* after task_join, once nothing can task_wake it any more */
+void task_free(Task **t)
+{
+	if (*t) {
+		SDL_DestroyCond((*t)->cond);
+		SDL_DestroyMutex((*t)->mutex);
+	}
+	av_freep(t);
+}
@@ -0,0 +1,32 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+/*
+ * One pool of worker threads for every player in the process, sized to
+ * the machine. Decoding and filtering run on it as tasks: a task does a
+ * bounded step of work and returns instead of blocking, so a full or empty
+ * queue never holds a worker. Each worker runs its own tasks in turn and
+ * steals from the others when it runs out. A task that has to block, the
+ * demuxer reading from the network, gets a thread of its own instead, see
+ * task_create_thread.
+ */
+typedef struct Task Task;
+
+enum {
+	TASK_DONE,	// finished for good, task_join returns
+	TASK_AGAIN,	// made progress, run again soon
+	TASK_WAIT,	// could not make progress, run again after task_wake
+};
+
+typedef int (*TaskFunc)(void *opaque);
+
+int sched_ref(int nb_workers);
+void sched_unref(void);
+
+Task *task_create(const char *name, TaskFunc func, void *opaque);
+Task *task_create_thread(const char *name, TaskFunc func, void *opaque);
+void task_wake(Task *t);
+void task_join(Task *t);
+void task_free(Task **t);
+
+#endif
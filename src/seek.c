@@ -0,0 +1,163 @@
+#include <libavformat/avformat.h>
+
+#include "internal.h"
+#include "debug.h"
+#include "seek.h"
+
+typedef struct IndexEntry {
+	int64_t ts;	// in AV_TIME_BASE
+	int64_t pos;	// in bytes
+	int run;	// entries read without a seek in between share a run
+} IndexEntry;
+
+struct SeekIndex {
+	AVStream *index_stream;
+	IndexEntry *index_entries;
+	unsigned int index_alloc_size;
+	int index_nb_entries;
+	int index_run;
+	int byte_seek;		// the format resyncs from any offset, the index above is used
+};
+
+/*
+ * Index the stream we present from. Only formats that resync from any
+ * byte offset (MPEG-TS/PS, ffplay's rule) are sought by bytes: in
+ * Matroska or AVI a packet's pos points into a cluster or chunk, and the
+ * demuxer lands after the keyframe or loses the timestamps. For those the
+ * keyframes go to libavformat's own index, avformat_seek_file uses it.
+ */
+int seek_index_init(Player *p)
+{
+	AVFormatContext *fmt_ctx = p->fmt_ctx;
+
+	p->seek = av_mallocz(sizeof(SeekIndex));
+	if (!p->seek)
+		return AVERROR(ENOMEM);
+
+	int ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+	if (ret < 0)
+		ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+
+	if (ret < 0)
+		return 0;
+
+	p->seek->index_stream = fmt_ctx->streams[ret];
+	p->seek->byte_seek = (fmt_ctx->iformat->flags & AVFMT_TS_DISCONT) &&
+		!(fmt_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK) &&
+		fmt_ctx->pb && (fmt_ctx->pb->seekable & AVIO_SEEKABLE_NORMAL);
+	if (!p->seek->byte_seek)
+		debug_info("keyframes go to the libavformat index, %s does not seek by bytes\n",
+			fmt_ctx->iformat->name);
+	return 0;
+}
+
+void seek_index_destroy(Player *p)
+{
+	if (p->seek)
+		av_freep(&p->seek->index_entries);
+	av_freep(&p->seek);
+}
+
+/* first entry after ts, or index_nb_entries */
+static int seek_index_search(Player *p, int64_t ts)
+{
+	SeekIndex *si = p->seek;
+	int lo = 0, hi = si->index_nb_entries;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (si->index_entries[mid].ts <= ts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* demuxer only, like the lookup below, so the index needs no lock */
+void seek_index_add(Player *p, const AVPacket *pkt)
+{
+	SeekIndex *si = p->seek;
+
+	if (!si->index_stream || pkt->stream_index != si->index_stream->index ||
+		!(pkt->flags & AV_PKT_FLAG_KEY) || pkt->pos < 0)
+		return;
+
+	int64_t ts = (pkt->pts != AV_NOPTS_VALUE) ? pkt->pts : pkt->dts;
+	if (ts == AV_NOPTS_VALUE)
+		return;
+
+	if (!si->byte_seek) {
+		av_add_index_entry(si->index_stream, pkt->pos, ts, pkt->size, 0, AVINDEX_KEYFRAME);
+		return;
+	}
+
+	ts = av_rescale_q(ts, si->index_stream->time_base, AV_TIME_BASE_Q);
+
+	/* read again after a seek back */
+	int i = seek_index_search(p, ts);
+	if (i > 0 && si->index_entries[i - 1].pos == pkt->pos)
+		return;
+
+	IndexEntry *entries = av_fast_realloc(si->index_entries, &si->index_alloc_size,
+		(si->index_nb_entries + 1) * sizeof(IndexEntry));
+	if (!entries)
+		return;
+	si->index_entries = entries;
+
+	memmove(&si->index_entries[i + 1], &si->index_entries[i], (si->index_nb_entries - i) * sizeof(IndexEntry));
+	si->index_entries[i].ts = ts;
+	si->index_entries[i].pos = pkt->pos;
+	si->index_entries[i].run = si->index_run;
+	si->index_nb_entries++;
+}
+
+/*
+ * Byte offset of the last keyframe at or before ts, -1 if we don't know it.
+ * The keyframes around ts must come from the same run, otherwise a seek
+ * may have skipped over keyframes that never made it into the index.
+ */
+static int64_t seek_index_lookup(Player *p, int64_t ts)
+{
+	SeekIndex *si = p->seek;
+	int i = seek_index_search(p, ts);
+
+	if (!si->byte_seek)
+		return -1;
+	if (i == 0 || i == si->index_nb_entries)
+		return -1;
+	if (si->index_entries[i - 1].run != si->index_entries[i].run)
+		return -1;
+
+	return si->index_entries[i - 1].pos;
+}
+
+/* demuxer only: seek to the keyframe before target, in seconds */
+int seek_file(Player *p, double target)
+{
+	AVFormatContext *fmt_ctx = p->fmt_ctx;
+	int64_t ts = target * AV_TIME_BASE;
+	int64_t pos = seek_index_lookup(p, ts);
+	int ret = 0;
+
+	/* whatever we read next does not follow what we read before */
+	p->seek->index_run++;
+
+	if (pos >= 0) {
+		ret = av_seek_frame(fmt_ctx, -1, pos, AVSEEK_FLAG_BYTE);
+		if (ret >= 0) {
+			debug_info("seek to %.3f from the keyframe index, byte %"PRId64"\n", target, pos);
+			return ret;
+		}
+	}
+
+	ret = avformat_seek_file(fmt_ctx, -1, INT64_MIN, ts, ts, 0);
+	if (ret < 0) {
+		fprintf(stderr, "Could not seek to %.3f (%s)\n", target, av_err2str(ret));
+		return ret;
+	}
+
+	debug_info("seek to %.3f\n", target);
+	return ret;
+}
@@ -0,0 +1,19 @@
+#ifndef __SEEK_H__
+#define __SEEK_H__
+
+#include <libavformat/avformat.h>
+
+/*
+ * Keyframe index the demuxer fills in as it reads, so a seek back into
+ * what was already read jumps straight to the keyframe before the target,
+ * instead of having libavformat search for it: by its byte offset where
+ * the format resyncs from any offset, through libavformat's index where
+ * it does not.
+ */
+int seek_index_init(Player *p);
+void seek_index_destroy(Player *p);
+void seek_index_add(Player *p, const AVPacket *pkt);
+
+int seek_file(Player *p, double target);
+
+#endif
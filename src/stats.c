@@ -0,0 +1,439 @@
+#include <math.h>
+
+#include <libavutil/common.h>
+#include <libavutil/time.h>
+
+#include <SDL2/SDL.h>
+
+#include "internal.h"
+#include "debug.h"
+#include "stats.h"
+
+#define STATS_MAX_QUEUES 4
+
+static const char *stage_names[STATS_NB_STAGES] = {
+	[STATS_IO_READ]		= "io_read",
+	[STATS_DEMUX]		= "demux",
+	[STATS_VIDEO_DECODE]	= "video_decode",
+	[STATS_VIDEO_FILTER]	= "video_filter",
+	[STATS_VIDEO_UPLOAD]	= "video_upload",
+	[STATS_VIDEO_PRESENT]	= "video_present",
+	[STATS_VIDEO_ENCODE]	= "video_encode",
+	[STATS_AUDIO_DECODE]	= "audio_decode",
+	[STATS_AUDIO_FILTER]	= "audio_filter",
+	[STATS_AUDIO_CONVERT]	= "audio_convert",
+	[STATS_AUDIO_ENCODE]	= "audio_encode",
+};
+
+static const char *counter_names[STATS_NB_COUNTERS] = {
+	[STATS_VIDEO_DROPS_EARLY]	= "video_drops_early",
+	[STATS_VIDEO_DROPS_LATE]	= "video_drops_late",
+	[STATS_AUDIO_UNDERRUNS]		= "audio_underruns",
+	[STATS_LIVE_DROPS]		= "live_drops",
+	[STATS_FRAME_POOL_GETS]		= "frame_pool_gets",
+	[STATS_FRAME_POOL_MISSES]	= "frame_pool_misses",
+};
+
+struct Stats {
+	StatsStage stages[STATS_NB_STAGES];
+	SDL_atomic_t counters[STATS_NB_COUNTERS];
+	StatsHistogram drift;	// absolute A/V drift in us, last is signed
+	StatsHistogram latency;	// live sources only, in us
+	int64_t open_time;	// when player_open started, in us
+	int64_t first_frame;	// from open_time to the first video frame out, in us, 0 before
+
+	struct {
+		const char *name;
+		PacketQueue *q;
+	} queues[STATS_MAX_QUEUES];
+	int nb_queues;
+
+	FILE *stats_file;
+	SDL_TimerID statsTimerId;
+	SDL_mutex *dump_mutex;	// one dump at a time, the timer's against stats_stop's
+	int stopped;		// under dump_mutex, the timer may still fire once
+	SDL_atomic_t in_proc;	// stats_proc calls not out yet
+	int overlay;
+	double start_time;
+};
+
+/* before any other module, they all report into it from the start */
+int stats_init(Player *p)
+{
+	int i = 0;
+
+	p->stats = av_mallocz(sizeof(Stats));
+	if (!p->stats)
+		return AVERROR(ENOMEM);
+
+	for (i = 0; i < STATS_NB_STAGES; i++)
+		p->stats->stages[i].name = stage_names[i];
+	p->stats->open_time = av_gettime_relative();
+
+	return 0;
+}
+
+void stats_free(Player *p)
+{
+	if (p->stats)
+		SDL_DestroyMutex(p->stats->dump_mutex);
+	av_freep(&p->stats);
+}
+
+static void histogram_add(StatsHistogram *h, int64_t value)
+{
+	int i = (value > 0) ? FFMIN(av_log2(value), STATS_HIST_BUCKETS - 1) : 0;
+
+	h->buckets[i]++;
+	h->count++;
+	h->sum += value;
+	h->max = FFMAX(h->max, value);
+	h->last = value;
+}
+
+/* upper bound of the bucket the q-th quantile falls into */
+static int64_t histogram_quantile(const StatsHistogram *h, double q)
+{
+	int64_t n = 0, target = ceil(h->count * q);
+	int i = 0;
+
+	if (!h->count)
+		return 0;
+
+	for (i = 0; i < STATS_HIST_BUCKETS - 1; i++) {
+		n += h->buckets[i];
+		if (n >= target)
+			break;
+	}
+
+	return (int64_t)2 << i;
+}
+
+/* inline */ int64_t stats_begin(void)
+{
+	return av_gettime_relative();
+}
+
+/* inline */ void stats_end(Player *p, int stage, int64_t begin)
+{
+	histogram_add(&p->stats->stages[stage].time, av_gettime_relative() - begin);
+}
+
+/* inline */ void stats_add_frames(Player *p, int stage, int nb_frames)
+{
+	p->stats->stages[stage].frames += nb_frames;
+}
+
+/* inline */ void stats_add_bytes(Player *p, int stage, int nb_bytes)
+{
+	p->stats->stages[stage].bytes += nb_bytes;
+}
+
+/* inline */ void stats_count(Player *p, int counter)
+{
+	SDL_AtomicAdd(&p->stats->counters[counter], 1);
+}
+
+/* diff is the clock of the slave stream minus the master clock, in seconds */
+void stats_drift(Player *p, double diff)
+{
+	Stats *st = p->stats;
+
+	if (isnan(diff))
+		return;
+
+	histogram_add(&st->drift, fabs(diff) * 1000000);
+	st->drift.last = diff * 1000000;
+}
+
+/* live sources, see live_get_latency, in seconds */
+void stats_latency(Player *p, double latency)
+{
+	histogram_add(&p->stats->latency, FFMAX(latency, 0) * 1000000);
+}
+
+/* the presentation side, once per player: the frame went to the screen,
+ * the callback or the benchmark */
+void stats_first_frame(Player *p)
+{
+	Stats *st = p->stats;
+
+	if (st->first_frame)
+		return;
+
+	st->first_frame = FFMAX(av_gettime_relative() - st->open_time, 1);
+	debug_info("first frame %.1fms after open\n", st->first_frame / 1000.0);
+}
+
+/* in seconds, NAN before the first video frame */
+/* inline */ double stats_time_to_first_frame(Player *p)
+{
+	return p->stats->first_frame ? p->stats->first_frame / 1000000.0 : NAN;
+}
+
+/* the codecs may be opened side by side, see open_codecs */
+void stats_register_queue(Player *p, const char *name, PacketQueue *q)
+{
+	static SDL_SpinLock lock = 0;
+	Stats *st = p->stats;
+
+	SDL_AtomicLock(&lock);
+	if (st->nb_queues < STATS_MAX_QUEUES) {
+		st->queues[st->nb_queues].name = name;
+		st->queues[st->nb_queues].q = q;
+		st->nb_queues++;
+	}
+	SDL_AtomicUnlock(&lock);
+}
+
+/* inline */ const StatsStage *stats_stage(Player *p, int stage)
+{
+	return &p->stats->stages[stage];
+}
+
+/* inline */ int stats_counter(Player *p, int counter)
+{
+	return SDL_AtomicGet(&p->stats->counters[counter]);
+}
+
+static double queue_fill(PacketQueue *q)
+{
+	if (q->max_duration)
+		return (double)SDL_AtomicGet(&q->duration) / q->max_duration;
+	if (q->max_size)
+		return (double)SDL_AtomicGet(&q->size) / q->max_size;
+
+	return (double)packet_queue_nb_packets(q) / q->capacity;
+}
+
+static void stats_dump_json(Player *p, FILE *out)
+{
+	Stats *st = p->stats;
+	int i = 0;
+
+	fprintf(out, "{\"time\": %.3f, \"stages\": {", av_gettime_relative() / 1000000.0 - st->start_time);
+	for (i = 0; i < STATS_NB_STAGES; i++) {
+		const StatsHistogram *h = &st->stages[i].time;
+		fprintf(out, "%s\"%s\": {\"calls\": %"PRId64", \"frames\": %d, \"bytes\": %"PRId64", \"mb_per_s\": %.1f, \"avg_us\": %.1f, \"max_us\": %"PRId64", \"p50_us\": %"PRId64", \"p99_us\": %"PRId64"}",
+			i ? ", " : "", st->stages[i].name, h->count, st->stages[i].frames, st->stages[i].bytes,
+			h->sum ? st->stages[i].bytes / (double)h->sum : 0,
+			h->count ? (double)h->sum / h->count : 0, h->max,
+			histogram_quantile(h, 0.5), histogram_quantile(h, 0.99));
+	}
+
+	fprintf(out, "}, \"counters\": {");
+	for (i = 0; i < STATS_NB_COUNTERS; i++)
+		fprintf(out, "%s\"%s\": %d", i ? ", " : "", counter_names[i], stats_counter(p, i));
+
+	fprintf(out, "}, \"drift_ms\": {\"last\": %.3f, \"avg_abs\": %.3f, \"max_abs\": %.3f, \"p99_abs\": %.3f}",
+		st->drift.last / 1000.0, st->drift.count ? st->drift.sum / 1000.0 / st->drift.count : 0,
+		st->drift.max / 1000.0, histogram_quantile(&st->drift, 0.99) / 1000.0);
+
+	if (st->first_frame)
+		fprintf(out, ", \"first_frame_ms\": %.3f", st->first_frame / 1000.0);
+
+	if (st->latency.count)
+		fprintf(out, ", \"latency_ms\": {\"last\": %.3f, \"avg\": %.3f, \"max\": %.3f, \"p99\": %.3f}",
+			st->latency.last / 1000.0, st->latency.sum / 1000.0 / st->latency.count,
+			st->latency.max / 1000.0, histogram_quantile(&st->latency, 0.99) / 1000.0);
+
+	fprintf(out, ", \"queues\": {");
+	for (i = 0; i < st->nb_queues; i++) {
+		PacketQueue *q = st->queues[i].q;
+		fprintf(out, "%s\"%s\": {\"packets\": %d, \"bytes\": %d, \"duration_ms\": %d}",
+			i ? ", " : "", st->queues[i].name, packet_queue_nb_packets(q),
+			SDL_AtomicGet(&q->size), SDL_AtomicGet(&q->duration));
+	}
+	fprintf(out, "}}\n");
+}
+
+static void stats_dump_text(Player *p, FILE *out)
+{
+	Stats *st = p->stats;
+	int i = 0;
+
+	fprintf(out, "stats at %.3fs\n", av_gettime_relative() / 1000000.0 - st->start_time);
+	for (i = 0; i < STATS_NB_STAGES; i++) {
+		const StatsHistogram *h = &st->stages[i].time;
+		if (!h->count)
+			continue;
+		fprintf(out, "  %-14s %8"PRId64" calls %8d frames  avg %8.1fus  max %8"PRId64"us  p50 <%"PRId64"us  p99 <%"PRId64"us\n",
+			st->stages[i].name, h->count, st->stages[i].frames,
+			(double)h->sum / h->count, h->max,
+			histogram_quantile(h, 0.5), histogram_quantile(h, 0.99));
+		if (st->stages[i].bytes && h->sum)
+			fprintf(out, "  %-14s %8.1f MB/s\n", "", st->stages[i].bytes / (double)h->sum);
+	}
+
+	for (i = 0; i < st->nb_queues; i++) {
+		PacketQueue *q = st->queues[i].q;
+		fprintf(out, "  %-14s %8d packets %8d bytes %6d ms\n", st->queues[i].name,
+			packet_queue_nb_packets(q), SDL_AtomicGet(&q->size), SDL_AtomicGet(&q->duration));
+	}
+
+	fprintf(out, "  drift %.1fms (avg %.1fms, max %.1fms)  drops %d early %d late  underruns %d\n",
+		st->drift.last / 1000.0, st->drift.count ? st->drift.sum / 1000.0 / st->drift.count : 0, st->drift.max / 1000.0,
+		stats_counter(p, STATS_VIDEO_DROPS_EARLY), stats_counter(p, STATS_VIDEO_DROPS_LATE),
+		stats_counter(p, STATS_AUDIO_UNDERRUNS));
+
+	if (stats_counter(p, STATS_FRAME_POOL_GETS))
+		fprintf(out, "  frame pool %d hits %d misses\n",
+			stats_counter(p, STATS_FRAME_POOL_GETS) - stats_counter(p, STATS_FRAME_POOL_MISSES),
+			stats_counter(p, STATS_FRAME_POOL_MISSES));
+
+	if (st->first_frame)
+		fprintf(out, "  first frame %.1fms after open\n", st->first_frame / 1000.0);
+
+	if (st->latency.count)
+		fprintf(out, "  latency %.1fms (avg %.1fms, max %.1fms)  live drops %d\n",
+			st->latency.last / 1000.0, st->latency.sum / 1000.0 / st->latency.count,
+			st->latency.max / 1000.0, stats_counter(p, STATS_LIVE_DROPS));
+}
+
+void stats_dump(Player *p, FILE *out, int json)
+{
+	if (json)
+		stats_dump_json(p, out);
+	else
+		stats_dump_text(p, out);
+
+	fflush(out);
+}
+
+/* on the SDL timer thread, SDL_RemoveTimer does not wait for it */
+static Uint32 stats_proc(Uint32 interval, void *opaque)
+{
+	Player *p = opaque;
+	Stats *st = p->stats;
+
+	SDL_AtomicAdd(&st->in_proc, 1);
+	SDL_LockMutex(st->dump_mutex);
+	if (st->stopped)
+		interval = 0;
+	else
+		stats_dump(p, st->stats_file ? st->stats_file : stderr, !!st->stats_file);
+	SDL_UnlockMutex(st->dump_mutex);
+	SDL_AtomicAdd(&st->in_proc, -1);
+
+	return interval;
+}
+
+/* dump every interval seconds, as JSON lines into file if there is one, else to stderr */
+int stats_start(Player *p, int interval, const char *file)
+{
+	Stats *st = p->stats;
+
+	st->start_time = av_gettime_relative() / 1000000.0;
+
+	if (interval <= 0)
+		return 0;
+
+	st->dump_mutex = SDL_CreateMutex();
+	if (!st->dump_mutex)
+		return AVERROR(ENOMEM);
+
+	if (file) {
+		st->stats_file = fopen(file, "w");
+		if (!st->stats_file) {
+			fprintf(stderr, "Could not open stats file %s\n", file);
+			return -1;
+		}
+	}
+
+	st->statsTimerId = SDL_AddTimer(interval * 1000, stats_proc, p);
+	return 0;
+}
+
+void stats_stop(Player *p)
+{
+	Stats *st = p->stats;
+
+	if (!st->dump_mutex)
+		return;
+
+	/* a callback already running finishes first, any later one does nothing */
+	SDL_RemoveTimer(st->statsTimerId);
+	SDL_LockMutex(st->dump_mutex);
+	if (st->statsTimerId) {
+		st->statsTimerId = 0;
+
+		/* one last time, so short runs still get a line */
+		stats_dump(p, st->stats_file ? st->stats_file : stderr, !!st->stats_file);
+	}
+	st->stopped = 1;
+
+	if (st->stats_file) {
+		fclose(st->stats_file);
+		st->stats_file = NULL;
+	}
+	SDL_UnlockMutex(st->dump_mutex);
+
+	/* one that was waiting for us lets go of the mutex before stats_free */
+	while (SDL_AtomicGet(&st->in_proc))
+		SDL_Delay(1);
+}
+
+/* inline */ void stats_toggle_overlay(Player *p)
+{
+	Stats *st = p->stats;
+
+	st->overlay = !st->overlay;
+}
+
+static void stats_draw_bar(SDL_Renderer *renderer, SDL_Rect *rect, double fraction,
+	Uint8 r, Uint8 g, Uint8 b)
+{
+	SDL_Rect bar = *rect;
+
+	SDL_SetRenderDrawColor(renderer, 64, 64, 64, 160);
+	SDL_RenderFillRect(renderer, rect);
+
+	bar.w = rect->w * av_clipd(fraction, 0, 1);
+	SDL_SetRenderDrawColor(renderer, r, g, b, 224);
+	SDL_RenderFillRect(renderer, &bar);
+
+	rect->y += rect->h * 3 / 2;
+}
+
+/*
+ * There is no font renderer linked in, so the overlay is bars only, top
+ * to bottom: the fill of every packet queue (green), the last call of
+ * each video and audio stage against 40 ms (yellow), and the A/V drift
+ * from the middle, +-100 ms at the edges (red). The dump has the numbers.
+ */
+void stats_draw_overlay(Player *p, SDL_Renderer *renderer, int w, int h)
+{
+	Stats *st = p->stats;
+	static const int timed[] = {
+		STATS_VIDEO_DECODE, STATS_VIDEO_FILTER, STATS_VIDEO_UPLOAD,
+		STATS_VIDEO_PRESENT, STATS_AUDIO_DECODE,
+	};
+	SDL_Rect rect;
+	int i = 0;
+
+	if (!st->overlay)
+		return;
+
+	rect.h = FFMAX(h / 60, 3);
+	rect.w = w / 3;
+	rect.x = rect.h;
+	rect.y = rect.h;
+
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+
+	for (i = 0; i < st->nb_queues; i++)
+		stats_draw_bar(renderer, &rect, queue_fill(st->queues[i].q), 0, 224, 0);
+
+	for (i = 0; i < FF_ARRAY_ELEMS(timed); i++)
+		stats_draw_bar(renderer, &rect, st->stages[timed[i]].time.last / 40000.0, 224, 224, 0);
+
+	SDL_Rect center = rect;
+	double d = av_clipd(st->drift.last / 100000.0, -1, 1);
+	stats_draw_bar(renderer, &rect, 0, 0, 0, 0);
+	center.w = fabs(d) * rect.w / 2;
+	center.x = rect.x + rect.w / 2 - (d < 0 ? center.w : 0);
+	SDL_SetRenderDrawColor(renderer, 224, 0, 0, 224);
+	SDL_RenderFillRect(renderer, &center);
+
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+}
@@ -0,0 +1,84 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <SDL2/SDL_render.h>
+
+#include "pktq.h"
+
+#define STATS_HIST_BUCKETS 20
+
+enum {
+	STATS_IO_READ,
+	STATS_DEMUX,
+	STATS_VIDEO_DECODE,
+	STATS_VIDEO_FILTER,
+	STATS_VIDEO_UPLOAD,
+	STATS_VIDEO_PRESENT,
+	STATS_VIDEO_ENCODE,
+	STATS_AUDIO_DECODE,
+	STATS_AUDIO_FILTER,
+	STATS_AUDIO_CONVERT,
+	STATS_AUDIO_ENCODE,
+	STATS_NB_STAGES,
+};
+
+enum {
+	STATS_VIDEO_DROPS_EARLY,
+	STATS_VIDEO_DROPS_LATE,
+	STATS_AUDIO_UNDERRUNS,
+	STATS_LIVE_DROPS,
+	STATS_FRAME_POOL_GETS,
+	STATS_FRAME_POOL_MISSES,
+	STATS_NB_COUNTERS,
+};
+
+/* log2 histogram, bucket i counts the values in [2^i, 2^(i+1)) */
+typedef struct StatsHistogram {
+	int64_t count;
+	int64_t sum;
+	int64_t max;
+	int64_t last;
+	int64_t buckets[STATS_HIST_BUCKETS];
+} StatsHistogram;
+
+typedef struct StatsStage {
+	const char *name;
+	StatsHistogram time;	// per call, in us
+	int frames;
+	int64_t bytes;
+} StatsStage;
+
+/*
+ * Always on instrumentation. Every stage has a single writer thread, so
+ * updates are plain stores; counters are atomic, the frame pool counts
+ * from every frame thread of the decoder; readers (the periodic dump, the
+ * overlay, --bench) may see a slightly stale value, never a torn one on
+ * the platforms we run on.
+ */
+int stats_init(Player *p);
+void stats_free(Player *p);
+
+int64_t stats_begin(void);
+void stats_end(Player *p, int stage, int64_t begin);
+void stats_add_frames(Player *p, int stage, int nb_frames);
+void stats_add_bytes(Player *p, int stage, int nb_bytes);
+void stats_count(Player *p, int counter);
+void stats_drift(Player *p, double diff);
+void stats_latency(Player *p, double latency);
+void stats_first_frame(Player *p);
+double stats_time_to_first_frame(Player *p);
+void stats_register_queue(Player *p, const char *name, PacketQueue *q);
+
+const StatsStage *stats_stage(Player *p, int stage);
+int stats_counter(Player *p, int counter);
+
+void stats_dump(Player *p, FILE *out, int json);
+int stats_start(Player *p, int interval, const char *file);
+void stats_stop(Player *p);
+
+void stats_toggle_overlay(Player *p);
+void stats_draw_overlay(Player *p, SDL_Renderer *renderer, int w, int h);
+
+#endif
@@ -1,145 +1,642 @@
+#include "config.h"
+
+#include <math.h>
+
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 
 #include <SDL2/SDL.h>
 
+#ifdef HAVE_LIBASS
+#include <ass/ass.h>
+#endif
+
+#include "internal.h"
 #include "pktq.h"
+#include "sched.h"
+#include "stats.h"
 #include "subtitle.h"
 #include "debug.h"
 
-static int sub_stream_idx = -1;
-static AVStream *sub_stream = NULL;
-static AVCodecContext *sub_dec_ctx = NULL;
-static AVSubtitle _frame_sub, *frame_sub = NULL;
-static int sub_frame_count = 0;
-static PacketQueue sub_queue = PACKET_QUEUE_INITIALIZER;
-static SDL_TimerID subtitleTimerId = 0;
+/* a text subtitle without an end is shown this long, in seconds */
+#define SUB_DEFAULT_DURATION 5.0
+
+typedef struct SubtitleEntry {
+	AVSubtitle sub;
+	double start;	// in seconds
+	double end;	// INFINITY until the next subtitle ends it
+	unsigned id;	// tells entries apart when the active set changes
+	int text;	// has ASS rects, rendered by libass
+} SubtitleEntry;
+
+struct SubtitleState {
+	int sub_stream_idx;		// the demuxer's, the decoder follows on the next flush
+	AVStream *sub_stream;		// the decoder's
+	AVCodecContext *sub_dec_ctx;
+	int sub_frame_count;
+	int64_t sub_last_pts;	// start of the last decoded subtitle, in AV_TIME_BASE
+	PacketQueue sub_queue;
+	Task *sub_task;
+	int sub_serial;		// serial of the packets being decoded
 
-static void subtitle_dump(AVSubtitle *sub)
+	/*
+	 * Decoded subtitles sorted by start time, filled by the decoder and
+	 * queried by the renderer with the pts of every frame it shows. Entries
+	 * are freed once the renderer is past their end, or on a seek.
+	 */
+	SDL_mutex *timeline_mutex;
+	SubtitleEntry *timeline;
+	int timeline_nb;
+	unsigned int timeline_alloc_size;
+	unsigned timeline_next_id;
+
+	/* renderer side: what the overlay texture was rasterized from */
+	uint64_t sub_active_sig;	// of the entries active at the last frame
+	int sub_texture_empty;
+	SDL_Texture *sub_texture;
+	int sub_texture_w, sub_texture_h;
+
+#ifdef HAVE_LIBASS
+	ASS_Library *ass_library;
+	ASS_Renderer *ass_renderer;
+	ASS_Track *ass_track;
+#endif
+};
+
+static void subtitle_dump(Player *p, AVSubtitle *sub)
 {
-	printf("format = %d\n", sub->format);
-	printf("start_display_time = %d\n", sub->start_display_time);
-	printf("end_display_time = %d\n", sub->end_display_time);
-	printf("num_rects = %d\n", sub->num_rects);
-	printf("pts = %d\n", get_subtitle_pts());
+	debug_info("format = %d\n", sub->format);
+	debug_info("start_display_time = %d\n", sub->start_display_time);
+	debug_info("end_display_time = %d\n", sub->end_display_time);
+	debug_info("num_rects = %d\n", sub->num_rects);
+	debug_info("pts = %d\n", get_subtitle_pts(p));
 
 	int i = 0;
 	for (i = 0; i < sub->num_rects; ++i) {
-		printf("rects[%d].x = %d\n", i, sub->rects[i]->x);
-		printf("rects[%d].y = %d\n", i, sub->rects[i]->y);
-		printf("rects[%d].w = %d\n", i, sub->rects[i]->w);
-		printf("rects[%d].h = %d\n", i, sub->rects[i]->h);
-		printf("rects[%d].nb_colors = %d\n", i, sub->rects[i]->x);
-		printf("rects[%d].type = %d\n", i, sub->rects[i]->type);
-		printf("rects[%d].text = %s\n", i, sub->rects[i]->text);
-		printf("rects[%d].ass = %s\n", i, sub->rects[i]->ass);
+		debug_info("rects[%d].x = %d\n", i, sub->rects[i]->x);
+		debug_info("rects[%d].y = %d\n", i, sub->rects[i]->y);
+		debug_info("rects[%d].w = %d\n", i, sub->rects[i]->w);
+		debug_info("rects[%d].h = %d\n", i, sub->rects[i]->h);
+		debug_info("rects[%d].nb_colors = %d\n", i, sub->rects[i]->nb_colors);
+		debug_info("rects[%d].type = %d\n", i, sub->rects[i]->type);
+		debug_info("rects[%d].text = %s\n", i, sub->rects[i]->text);
+		debug_info("rects[%d].ass = %s\n", i, sub->rects[i]->ass);
 	}
 }
 
-static Uint32 subtitle_proc(Uint32 interval, void *opaque)
+/* drop entries [0, n) of the timeline, with timeline_mutex held */
+static void timeline_remove(Player *p, int n)
 {
-	int ret = 0;
+	SubtitleState *ss = p->subtitle;
+	int i = 0;
 
-	if (frame_sub) {
-		subtitle_dump(frame_sub);
-	} else {
-		frame_sub = &_frame_sub;
+	for (i = 0; i < n; i++)
+		avsubtitle_free(&ss->timeline[i].sub);
+
+	memmove(ss->timeline, ss->timeline + n, (ss->timeline_nb - n) * sizeof(*ss->timeline));
+	ss->timeline_nb -= n;
+}
+
+/* decoder: the subtitle now shows from start to end, takes ownership of sub */
+static int timeline_insert(Player *p, AVSubtitle *sub, double start, double end)
+{
+	SubtitleState *ss = p->subtitle;
+	SubtitleEntry *entries = NULL;
+	int i = 0, pos = 0;
+
+	SDL_LockMutex(ss->timeline_mutex);
+
+	entries = av_fast_realloc(ss->timeline, &ss->timeline_alloc_size, (ss->timeline_nb + 1) * sizeof(*ss->timeline));
+	if (!entries) {
+		SDL_UnlockMutex(ss->timeline_mutex);
+		avsubtitle_free(sub);
+		return AVERROR(ENOMEM);
+	}
+	ss->timeline = entries;
+
+	/* they come in order almost always, search from the back */
+	for (pos = ss->timeline_nb; pos > 0 && ss->timeline[pos - 1].start > start; pos--);
+	memmove(ss->timeline + pos + 1, ss->timeline + pos, (ss->timeline_nb - pos) * sizeof(*ss->timeline));
+	ss->timeline_nb++;
+
+	ss->timeline[pos].sub = *sub;
+	ss->timeline[pos].start = start;
+	ss->timeline[pos].end = end;
+	ss->timeline[pos].id = ss->timeline_next_id++;
+	ss->timeline[pos].text = 0;
+	for (i = 0; i < sub->num_rects; i++) {
+		if (sub->rects[i]->type == SUBTITLE_ASS && sub->rects[i]->ass)
+			ss->timeline[pos].text = 1;
+	}
+
+	/* the ones before without an end show until this one, an empty one clears them */
+	for (i = 0; i < pos; i++) {
+		if (isinf(ss->timeline[i].end))
+			ss->timeline[i].end = start;
+	}
+	if (pos + 1 < ss->timeline_nb && isinf(end))
+		ss->timeline[pos].end = ss->timeline[pos + 1].start;
+
+	SDL_UnlockMutex(ss->timeline_mutex);
+	return 0;
+}
+
+static void timeline_clear(Player *p)
+{
+	SubtitleState *ss = p->subtitle;
+
+	SDL_LockMutex(ss->timeline_mutex);
+	if (ss->timeline_nb)
+		timeline_remove(p, ss->timeline_nb);
+	SDL_UnlockMutex(ss->timeline_mutex);
+}
+
+#ifdef HAVE_LIBASS
+/* a track for the script header of the decoder, the renderer uses it with timeline_mutex held */
+static void subtitle_init_ass(Player *p)
+{
+	SubtitleState *ss = p->subtitle;
+
+	if (ss->ass_track)
+		ass_free_track(ss->ass_track);
+	ss->ass_track = NULL;
+
+	/* text decoders give us ASS events and the script header to go with them */
+	if (!ss->sub_dec_ctx->subtitle_header)
+		return;
+
+	if (!ss->ass_library)
+		ss->ass_library = ass_library_init();
+	if (ss->ass_library && !ss->ass_renderer) {
+		ss->ass_renderer = ass_renderer_init(ss->ass_library);
+		if (ss->ass_renderer)
+			ass_set_fonts(ss->ass_renderer, NULL, "sans-serif", ASS_FONTPROVIDER_AUTODETECT, NULL, 1);
+		/* switched to text from a bitmap track, the texture is sized already */
+		if (ss->ass_renderer && ss->sub_texture)
+			ass_set_frame_size(ss->ass_renderer, ss->sub_texture_w, ss->sub_texture_h);
+	}
+	ss->ass_track = ss->ass_renderer ? ass_new_track(ss->ass_library) : NULL;
+	if (!ss->ass_track) {
+		fprintf(stderr, "Could not initialize libass, text subtitles are not shown\n");
+		return;
 	}
 
+	ass_process_codec_private(ss->ass_track, (char *)ss->sub_dec_ctx->subtitle_header,
+		ss->sub_dec_ctx->subtitle_header_size);
+}
+#endif
+
+/* the demuxer switched tracks, what the old one decoded goes with the flush */
+static void subtitle_switch_decoder(Player *p)
+{
+	SubtitleState *ss = p->subtitle;
+	AVStream *st = p->fmt_ctx->streams[ss->sub_stream_idx];
+
+	/* opened here, player_select_track may be asked again before we get to it */
+	if (!avcodec_is_open(st->codec) && open_stream_codec(p, st) < 0) {
+		fprintf(stderr, "Could not switch to subtitle track %d, staying on %d\n",
+			st->index, ss->sub_stream->index);
+		demux_request_track(p, ss->sub_stream->index);
+		return;
+	}
+
+	SDL_LockMutex(ss->timeline_mutex);
+	avcodec_close(ss->sub_dec_ctx);
+	ss->sub_stream = st;
+	ss->sub_dec_ctx = st->codec;
+#ifdef HAVE_LIBASS
+	subtitle_init_ass(p);
+#endif
+	SDL_UnlockMutex(ss->timeline_mutex);
+}
+
+/* decode ahead as packets come in, the timeline keeps them until they are due */
+static int subtitle_decode_step(void *opaque)
+{
+	Player *p = opaque;
+	SubtitleState *ss = p->subtitle;
 	AVPacket sub_pkt;
-	if (subtitle_dequeue(&sub_pkt)) {
-		decode_subtitle_packet(&sub_pkt);
-
-		int v_pts = get_video_pts();
-		int a_pts = get_audio_pts();
-		if (v_pts > 0) {
-			ret = get_subtitle_pts() - v_pts;
-		} else if (a_pts > 0) {
-			ret = get_subtitle_pts() - a_pts;
-		} else {	// both audio & video pts N.A.
-			frame_sub = NULL;
-			ret = 100;	// wait 100ms and try again	
-		}
-	} else {
-		frame_sub = NULL;
-		ret = 100;	// wait 100ms and try again
+	int serial = 0;
+
+	if (packet_queue_aborted(&ss->sub_queue))
+		return TASK_DONE;
+
+	if (!packet_queue_get(&ss->sub_queue, &sub_pkt, 0, &serial))
+		return TASK_WAIT;
+
+	/* first packet after a seek, nothing decoded so far is due any more */
+	if (serial != ss->sub_serial) {
+		if (ss->sub_stream->index != ss->sub_stream_idx)
+			subtitle_switch_decoder(p);
+		avcodec_flush_buffers(ss->sub_dec_ctx);
+		timeline_clear(p);
+		ss->sub_serial = serial;
 	}
 
-	return (ret > 0) ? ret : 1;
-} 
+	decode_subtitle_packet(p, &sub_pkt);
+	av_packet_unref(&sub_pkt);
 
-int decode_subtitle_packet(AVPacket *pkt)
+	return TASK_AGAIN;
+}
+
+int decode_subtitle_packet(Player *p, AVPacket *pkt)
 {
+	SubtitleState *ss = p->subtitle;
 	int ret = 0;
 	int decoded = pkt->size;
+	AVSubtitle sub;
 
 	int _got_frame = 0, *got_frame = &_got_frame;
 
-	if (pkt->stream_index == sub_stream_idx) {
-		ret = avcodec_decode_subtitle2(sub_dec_ctx, frame_sub, got_frame, pkt);
+	if (pkt->stream_index == ss->sub_stream->index) {
+		ret = avcodec_decode_subtitle2(ss->sub_dec_ctx, &sub, got_frame, pkt);
 		if (ret < 0) {
 			fprintf(stderr, "Error decoding sub frame (%s)\n", av_err2str(ret));
 			return ret;
 		}
 
 		if (*got_frame) {
-			debug_info("got subtitle\n");
+			/* sub.pts is in AV_TIME_BASE, the packet in the time base of the stream */
+			if (sub.pts == AV_NOPTS_VALUE && pkt->pts != AV_NOPTS_VALUE)
+				sub.pts = av_rescale_q(pkt->pts, ss->sub_stream->time_base, AV_TIME_BASE_Q);
+			if (sub.pts == AV_NOPTS_VALUE) {
+				fprintf(stderr, "Subtitle without a timestamp, dropped\n");
+				avsubtitle_free(&sub);
+				return decoded;
+			}
+
+			double pts = (double)sub.pts / AV_TIME_BASE;
+			double start = pts + sub.start_display_time / 1000.0;
+			double end = INFINITY;
+			if (sub.end_display_time > sub.start_display_time && sub.end_display_time != UINT32_MAX)
+				end = pts + sub.end_display_time / 1000.0;
+			else if (pkt->duration > 0)
+				end = pts + pkt->duration * av_q2d(ss->sub_stream->time_base);
+			else if (sub.format == 1)
+				end = start + SUB_DEFAULT_DURATION;
+
+			ss->sub_last_pts = llrint(start * AV_TIME_BASE);
+			debug_info("got subtitle n:%d %.3f-%.3f\n", ss->sub_frame_count++, start, end);
+			subtitle_dump(p, &sub);
+
+			if ((ret = timeline_insert(p, &sub, start, end)) < 0)
+				return ret;
 		}
 	}
 
 	return decoded;
 }
 
-int open_subtitle_codec(AVFormatContext *fmt_ctx)
+static int subtitle_realloc_texture(Player *p, SDL_Renderer *renderer, int w, int h)
+{
+	SubtitleState *ss = p->subtitle;
+
+	if (ss->sub_texture && ss->sub_texture_w == w && ss->sub_texture_h == h)
+		return 0;
+
+	if (ss->sub_texture)
+		SDL_DestroyTexture(ss->sub_texture);
+
+	ss->sub_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+		SDL_TEXTUREACCESS_STREAMING, w, h);
+	if (!ss->sub_texture) {
+		fprintf(stderr, "SDL: could not create subtitle texture - %s\n", SDL_GetError());
+		return -1;
+	}
+	SDL_SetTextureBlendMode(ss->sub_texture, SDL_BLENDMODE_BLEND);
+
+	ss->sub_texture_w = w;
+	ss->sub_texture_h = h;
+	ss->sub_texture_empty = 1;
+
+#ifdef HAVE_LIBASS
+	if (ss->ass_renderer)
+		ass_set_frame_size(ss->ass_renderer, w, h);
+#endif
+
+	return 1;
+}
+
+/* paletted bitmaps, the palette is ARGB already */
+static void subtitle_blit_bitmap(Player *p, uint8_t *pixels, int pitch, const AVSubtitleRect *rect)
+{
+	SubtitleState *ss = p->subtitle;
+	const uint32_t *palette = (const uint32_t *)rect->data[1];
+	int x = 0, y = 0;
+	int w = FFMIN(rect->w, ss->sub_texture_w - rect->x);
+	int h = FFMIN(rect->h, ss->sub_texture_h - rect->y);
+
+	if (rect->x < 0 || rect->y < 0)
+		return;
+
+	for (y = 0; y < h; y++) {
+		uint32_t *dst = (uint32_t *)(pixels + (rect->y + y) * pitch) + rect->x;
+		const uint8_t *src = rect->data[0] + y * rect->linesize[0];
+		for (x = 0; x < w; x++)
+			dst[x] = palette[src[x]];
+	}
+}
+
+#ifdef HAVE_LIBASS
+/* libass images are alpha masks in a single color, blend them over what is there */
+static void subtitle_blend_ass(Player *p, uint8_t *pixels, int pitch, const ASS_Image *img)
 {
-	int ret = open_codec_context(&sub_stream_idx, fmt_ctx, AVMEDIA_TYPE_SUBTITLE);
+	SubtitleState *ss = p->subtitle;
+
+	for (; img; img = img->next) {
+		uint32_t r = img->color >> 24, g = (img->color >> 16) & 0xff, b = (img->color >> 8) & 0xff;
+		uint32_t opacity = 255 - (img->color & 0xff);
+		int x = 0, y = 0;
+		int w = FFMIN(img->w, ss->sub_texture_w - img->dst_x);
+		int h = FFMIN(img->h, ss->sub_texture_h - img->dst_y);
+
+		for (y = 0; y < h; y++) {
+			uint32_t *dst = (uint32_t *)(pixels + (img->dst_y + y) * pitch) + img->dst_x;
+			const uint8_t *src = img->bitmap + y * img->stride;
+			for (x = 0; x < w; x++) {
+				uint32_t k = src[x] * opacity / 255;
+				uint32_t d = dst[x], da = d >> 24;
+				uint32_t a = 0;
+				if (!k)
+					continue;
+
+				da = da * (255 - k) / 255;
+				a = k + da;
+				dst[x] = (a << 24) |
+					(((r * k + ((d >> 16) & 0xff) * da) / a) << 16) |
+					(((g * k + ((d >> 8) & 0xff) * da) / a) << 8) |
+					((b * k + (d & 0xff) * da) / a);
+			}
+		}
+	}
+}
+#endif
+
+/*
+ * Draw the subtitles due at pts over the video, on the thread that owns
+ * the renderer. They are rasterized into an RGBA texture only when the
+ * set of due subtitles changes, every other frame SDL just blends the
+ * cached texture over the video one.
+ */
+void subtitle_render(Player *p, SDL_Renderer *renderer, const SDL_Rect *rect, double pts)
+{
+	SubtitleState *ss = p->subtitle;
+	uint8_t *pixels = NULL;
+	int pitch = 0, i = 0, j = 0, y = 0, n = 0;
+	int changed = 0, drawn = 0, text = 0;
+	uint64_t sig = 0;
+	void *ass_image = NULL;
+
+	if (!ss || isnan(pts))
+		return;
+
+	/* a track switch replaces the decoder and the libass renderer under it */
+	SDL_LockMutex(ss->timeline_mutex);
+
+	/* bitmap subtitles are positioned on their own canvas, if they have one */
+	int w = ss->sub_dec_ctx->width ? ss->sub_dec_ctx->width : rect->w;
+	int h = ss->sub_dec_ctx->height ? ss->sub_dec_ctx->height : rect->h;
+
+	int ret = subtitle_realloc_texture(p, renderer, w, h);
+	if (ret < 0) {
+		SDL_UnlockMutex(ss->timeline_mutex);
+		return;
+	}
+	changed = ret;
+
+	/* everything that ended before pts is gone for good */
+	for (n = 0; n < ss->timeline_nb && ss->timeline[n].end <= pts; n++);
+	if (n)
+		timeline_remove(p, n);
+
+	/* the entries due now, told apart by their ids */
+	sig = 14695981039346656037ULL;
+	for (i = 0; i < ss->timeline_nb && ss->timeline[i].start <= pts; i++) {
+		if (ss->timeline[i].end > pts) {
+			sig = (sig ^ ss->timeline[i].id) * 1099511628211ULL;
+			text |= ss->timeline[i].text;
+		}
+	}
+	if (sig != ss->sub_active_sig) {
+		ss->sub_active_sig = sig;
+		changed = 1;
+	}
+
+#ifdef HAVE_LIBASS
+	/* libass only ever holds the events due now */
+	if (ss->ass_track && changed) {
+		ass_flush_events(ss->ass_track);
+		for (i = 0; i < ss->timeline_nb && ss->timeline[i].start <= pts; i++) {
+			const SubtitleEntry *e = &ss->timeline[i];
+			if (e->end <= pts || !e->text)
+				continue;
+			for (j = 0; j < e->sub.num_rects; j++) {
+				if (e->sub.rects[j]->type == SUBTITLE_ASS && e->sub.rects[j]->ass)
+					ass_process_chunk(ss->ass_track, e->sub.rects[j]->ass, strlen(e->sub.rects[j]->ass),
+						llrint(e->start * 1000), llrint((e->end - e->start) * 1000));
+			}
+		}
+	}
+
+	/* styled text may move or fade on its own, libass tells us when */
+	if (ss->ass_track && text) {
+		int ass_changed = 0;
+		ass_image = ass_render_frame(ss->ass_renderer, ss->ass_track, llrint(pts * 1000), &ass_changed);
+		if (ass_changed)
+			changed = 1;
+	}
+#endif
+
+	if (changed) {
+		if (SDL_LockTexture(ss->sub_texture, NULL, (void **)&pixels, &pitch) < 0) {
+			SDL_UnlockMutex(ss->timeline_mutex);
+			fprintf(stderr, "SDL: could not lock subtitle texture - %s\n", SDL_GetError());
+			return;
+		}
+
+		for (y = 0; y < ss->sub_texture_h; y++)
+			memset(pixels + y * pitch, 0, ss->sub_texture_w * 4);
+
+		for (i = 0; i < ss->timeline_nb && ss->timeline[i].start <= pts; i++) {
+			const SubtitleEntry *e = &ss->timeline[i];
+			if (e->end <= pts)
+				continue;
+			for (j = 0; j < e->sub.num_rects; j++) {
+				if (e->sub.rects[j]->type == SUBTITLE_BITMAP) {
+					subtitle_blit_bitmap(p, pixels, pitch, e->sub.rects[j]);
+					drawn++;
+				}
+			}
+		}
+
+#ifdef HAVE_LIBASS
+		subtitle_blend_ass(p, pixels, pitch, ass_image);
+#endif
+
+		SDL_UnlockTexture(ss->sub_texture);
+		ss->sub_texture_empty = !ass_image && !drawn;
+	}
+
+	SDL_UnlockMutex(ss->timeline_mutex);
+
+	if (!ss->sub_texture_empty)
+		SDL_RenderCopy(renderer, ss->sub_texture, NULL, rect);
+}
+
+/* allocates p->subtitle, close_subtitle_codec frees it even if this fails */
+int open_subtitle_codec(Player *p)
+{
+	SubtitleState *ss = p->subtitle = av_mallocz(sizeof(SubtitleState));
+	if (!ss)
+		return AVERROR(ENOMEM);
+
+	ss->sub_last_pts = AV_NOPTS_VALUE;
+	ss->sub_texture_empty = 1;
+
+	int ret = open_codec_context(p, &ss->sub_stream_idx, AVMEDIA_TYPE_SUBTITLE);
 	if (ret >= 0) {
-		packet_queue_init(&sub_queue);
-		
-		sub_stream = fmt_ctx->streams[sub_stream_idx];
-		sub_dec_ctx = sub_stream->codec;
+		ss->sub_stream = p->fmt_ctx->streams[ss->sub_stream_idx];
+		ss->sub_dec_ctx = ss->sub_stream->codec;
+
+		/* subtitle packets are sparse and may last for seconds, only cap bytes */
+		if ((ret = packet_queue_init(&ss->sub_queue, ss->sub_stream->time_base,
+			p->opts.max_queue_size, 0)) < 0) {
+			fprintf(stderr, "Could not allocate packet queue\n");
+			return ret;
+		}
+		stats_register_queue(p, "subtitle", &ss->sub_queue);
+
+		if (!(ss->timeline_mutex = SDL_CreateMutex())) {
+			fprintf(stderr, "SDL: could not create mutex - %s\n", SDL_GetError());
+			return AVERROR(ENOMEM);
+		}
+
+#ifdef HAVE_LIBASS
+		subtitle_init_ass(p);
+#else
+		if (ss->sub_dec_ctx->subtitle_header)
+			debug_info("built without libass, text subtitles are not shown\n");
+#endif
+
+		ss->sub_task = task_create("subtitle_decode", subtitle_decode_step, p);
+		if (!ss->sub_task)
+			return AVERROR(ENOMEM);
+		ss->sub_queue.producer = p->demux_task;
+		ss->sub_queue.consumer = ss->sub_task;
 	}
 
 	return ret;
 }
 
-int close_subtitle_codec(void)
+int close_subtitle_codec(Player *p)
 {
-	avcodec_close(sub_dec_ctx);
+	SubtitleState *ss = p->subtitle;
+
+	if (!ss)
+		return 0;
+
+	/* the texture goes with the renderer */
+	ss->sub_texture = NULL;
+
+	/* it stops on the aborted queue, even if it never ran */
+	if (ss->sub_task)
+		packet_queue_abort(&ss->sub_queue);
+	task_join(ss->sub_task);
+	task_free(&ss->sub_task);
+
+	if (ss->timeline_nb)
+		timeline_remove(p, ss->timeline_nb);
+	av_freep(&ss->timeline);
+	ss->timeline_alloc_size = 0;
+	if (ss->timeline_mutex)
+		SDL_DestroyMutex(ss->timeline_mutex);
+	ss->timeline_mutex = NULL;
+
+#ifdef HAVE_LIBASS
+	if (ss->ass_track)
+		ass_free_track(ss->ass_track);
+	if (ss->ass_renderer)
+		ass_renderer_done(ss->ass_renderer);
+	if (ss->ass_library)
+		ass_library_done(ss->ass_library);
+	ss->ass_track = NULL;
+	ss->ass_renderer = NULL;
+	ss->ass_library = NULL;
+#endif
+
+	packet_queue_destroy(&ss->sub_queue);
+	avcodec_close(ss->sub_dec_ctx);
+	av_freep(&p->subtitle);
+	return 0;
 }
 
-/* inline */ int is_subtitle_packet(const AVPacket *pkt)
+/* inline */ int is_subtitle_packet(Player *p, const AVPacket *pkt)
 {
-	return (pkt->stream_index == sub_stream_idx);
+	return (pkt->stream_index == p->subtitle->sub_stream_idx);
 }
 
-/* inline */ int subtitle_enqueue(const AVPacket *pkt)
+/* inline */ int subtitle_enqueue(Player *p, const AVPacket *pkt)
 {
-	return packet_queue_put(&sub_queue, pkt);
+	return packet_queue_put(&p->subtitle->sub_queue, pkt, 0);
 }
 
-/* inline */ int subtitle_dequeue(AVPacket *pkt)
+/* demuxer only: adds what is queued to *size */
+/* inline */ int subtitle_queue_enough(Player *p, int *size)
 {
-	return packet_queue_get(&sub_queue, pkt);
+	*size += packet_queue_size(&p->subtitle->sub_queue);
+	return packet_queue_enough(&p->subtitle->sub_queue);
 }
 
-/* inline */ void subtitle_start()
+/* inline */ int subtitle_dequeue(Player *p, AVPacket *pkt)
 {
-	subtitleTimerId = SDL_AddTimer(1, subtitle_proc, NULL);
+	return packet_queue_get(&p->subtitle->sub_queue, pkt, 0, NULL);
 }
 
-/* inline */ void subtitle_stop()
+/* inline */ void subtitle_abort(Player *p)
 {
-	SDL_RemoveTimer(subtitleTimerId);
+	packet_queue_abort(&p->subtitle->sub_queue);
 }
 
-/* inline */ int get_subtitle_pts()
+/* inline */ void subtitle_interrupt(Player *p)
 {
-	int64_t pts = frame_sub->pts;
-	if (pts == AV_NOPTS_VALUE) {
+	packet_queue_interrupt(&p->subtitle->sub_queue);
+}
+
+/* demuxer only, right after a seek */
+/* inline */ void subtitle_flush(Player *p)
+{
+	packet_queue_flush(&p->subtitle->sub_queue);
+}
+
+/* demuxer only: queue stream_index from now on, the decoder switches over at the flush */
+void subtitle_switch_stream(Player *p, int stream_index)
+{
+	SubtitleState *ss = p->subtitle;
+
+	ss->sub_stream_idx = stream_index;
+	packet_queue_set_time_base(&ss->sub_queue, p->fmt_ctx->streams[stream_index]->time_base);
+	subtitle_flush(p);
+}
+
+/* inline */ int subtitle_get_stream(Player *p)
+{
+	return p->subtitle->sub_stream_idx;
+}
+
+void subtitle_start(Player *p)
+{
+	SubtitleState *ss = p->subtitle;
+
+	task_wake(ss->sub_task);
+}
+
+/* inline */ int get_subtitle_pts(Player *p)
+{
+	SubtitleState *ss = p->subtitle;
+
+	if (ss->sub_last_pts == AV_NOPTS_VALUE) {
 		return -1;
 	} else {
-		return av_rescale(pts, 1000, AV_TIME_BASE);
+		return av_rescale(ss->sub_last_pts, 1000, AV_TIME_BASE);
 	}
 }
-
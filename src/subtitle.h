@@ -1,17 +1,25 @@
 #ifndef __SUBTITLE_H__
 #define __SUBTITLE_H__
 
-int open_subtitle_codec(AVFormatContext *fmt_ctx);
-int close_subtitle_codec(void);
-int decode_subtitle_packet(AVPacket *pkt);
+#include <SDL2/SDL_render.h>
 
-int is_subtitle_packet(const AVPacket *pkt);
-int subtitle_enqueue(const AVPacket *pkt);
-int subtitle_dequeue(AVPacket *pkt);
+int open_subtitle_codec(Player *p);
+int close_subtitle_codec(Player *p);
+int decode_subtitle_packet(Player *p, AVPacket *pkt);
+void subtitle_render(Player *p, SDL_Renderer *renderer, const SDL_Rect *rect, double pts);
 
-void subtitle_start();
-void subtitle_stop();
+int is_subtitle_packet(Player *p, const AVPacket *pkt);
+int subtitle_enqueue(Player *p, const AVPacket *pkt);
+int subtitle_queue_enough(Player *p, int *size);
+int subtitle_dequeue(Player *p, AVPacket *pkt);
 
-int get_subtitle_pts();
+void subtitle_abort(Player *p);
+void subtitle_interrupt(Player *p);
+void subtitle_flush(Player *p);
+void subtitle_switch_stream(Player *p, int stream_index);
+int subtitle_get_stream(Player *p);
+void subtitle_start(Player *p);
+
+int get_subtitle_pts(Player *p);
 
 #endif
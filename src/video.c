@@ -1,52 +1,155 @@
 #include "config.h"
 
+#include <math.h>
+
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/timestamp.h>
 #include <libavutil/opt.h>
+#include <libavutil/imgutils.h>
 #include <libavfilter/avfiltergraph.h>
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
+#include <libswscale/swscale.h>
 
 #include <SDL2/SDL.h>
 
+#include "internal.h"
 #include "debug.h"
 #include "event.h"
 #include "pktq.h"
+#include "frameq.h"
+#include "sched.h"
+#include "clock.h"
+#include "bench.h"
+#include "stats.h"
+#include "export.h"
+#include "subtitle.h"
 #include "video.h"
 
-static int video_stream_idx = -1;
-static AVStream *video_stream = NULL;
-static AVCodecContext *video_dec_ctx = NULL;
-static AVFrame *frame_video = NULL;
-static int video_frame_count = 0;
-static PacketQueue video_queue = PACKET_QUEUE_INITIALIZER;
+/* ABR streams go back and forth between a few sizes, keep a texture for each */
+#define VIDEO_TEXTURE_CACHE 4
+
+typedef struct VideoTexture {
+	SDL_Texture *texture;
+	Uint32 format;
+	int w, h;
+	unsigned last_used;
+} VideoTexture;
+
+struct VideoState {
+	int video_stream_idx;
+	AVStream *video_stream;
+	AVCodecContext *video_dec_ctx;
+	AVFrame *frame_video;
+	int video_frame_count;
+	PacketQueue video_queue;
+	FrameQueue video_frameq;
+	Task *video_task;
+	int framedrop;
+	double frame_timer;		// time at which the last frame was due
+	double frame_last_pts;
+	int frame_last_serial;		// serial of the last frame shown
+	int video_serial;		// serial of the packets being decoded
+	double video_flush_target;	// seek target of the last flush
+	double video_seek_target;	// frames before this are decoded but not shown
+	int video_finished;		// serial the decoder was drained at
+	int video_draining;		// at the end of file, getting the delayed frames out
+	int video_finishing;		// drained, what the filters still hold goes first
+	int filter_pending;		// the graph may hold frames that did not fit the frame queue
+	int bench_upload;		// --bench: upload to the texture or discard
+	double video_speed;		// presentation side only
+	SDL_atomic_t video_skip_nonref;	// above 1x, don't even decode what nothing refers to
 
-static int width = 0, height = 0;
-static enum AVPixelFormat pix_fmt = AV_PIX_FMT_NONE;
+	int width, height;
+	enum AVPixelFormat pix_fmt;
 
-static SDL_Texture* sdlTexture = NULL;
-static SDL_Renderer* sdlRenderer = NULL;
-static SDL_Rect sdlRect = {0, 0, 0, 0};
-static SDL_TimerID videoTimerId = 0;
+	SDL_Window *sdlWindow;		// NULL when frames go to opts.video_cb
+	SDL_Texture *sdlTexture;	// one of textures, the one in use
+	VideoTexture textures[VIDEO_TEXTURE_CACHE];
+	unsigned texture_uses;
+	SDL_Renderer *sdlRenderer;
+	SDL_Rect sdlRect;
+	Uint32 sdlTextureFormat;
+	SDL_RendererInfo sdlRendererInfo;
+	int video_running;
 
-static AVFilterContext *buffersink_ctx;
-static AVFilterContext *buffersrc_ctx;
-static AVFilterGraph *filter_graph;
+	AVFilterContext *buffersink_ctx;
+	AVFilterContext *buffersrc_ctx;
+	AVFilterGraph *filter_graph;
+	char filter_descr[512];
+	AVRational filter_time_base;	// of the buffersink, the graph is rebuilt on seeks
+	struct SwsContext *sws_ctx;
+};
 
-int init_video_filters(const char *filters_descr)
+static const struct TextureFormatEntry {
+	enum AVPixelFormat format;
+	Uint32 texture_fmt;
+} sdl_texture_format_map[] = {
+	{ AV_PIX_FMT_YUV420P,	SDL_PIXELFORMAT_IYUV },
+	{ AV_PIX_FMT_YUVJ420P,	SDL_PIXELFORMAT_IYUV },
+	{ AV_PIX_FMT_NV12,	SDL_PIXELFORMAT_NV12 },
+	{ AV_PIX_FMT_NV21,	SDL_PIXELFORMAT_NV21 },
+	{ AV_PIX_FMT_YUYV422,	SDL_PIXELFORMAT_YUY2 },
+	{ AV_PIX_FMT_UYVY422,	SDL_PIXELFORMAT_UYVY },
+	{ AV_PIX_FMT_YVYU422,	SDL_PIXELFORMAT_YVYU },
+	{ AV_PIX_FMT_RGB565,	SDL_PIXELFORMAT_RGB565 },
+	{ AV_PIX_FMT_RGB24,	SDL_PIXELFORMAT_RGB24 },
+	{ AV_PIX_FMT_BGR24,	SDL_PIXELFORMAT_BGR24 },
+	{ AV_PIX_FMT_RGB32,	SDL_PIXELFORMAT_ARGB8888 },
+	{ AV_PIX_FMT_BGR32,	SDL_PIXELFORMAT_ABGR8888 },
+	{ AV_NE(AV_PIX_FMT_0RGB, AV_PIX_FMT_BGR0), SDL_PIXELFORMAT_RGB888 },
+	{ AV_NE(AV_PIX_FMT_0BGR, AV_PIX_FMT_RGB0), SDL_PIXELFORMAT_BGR888 },
+};
+
+/* the texture format that takes this pixel format as is, UNKNOWN if it needs converting */
+static Uint32 sdl_texture_format(Player *p, enum AVPixelFormat format)
 {
+	VideoState *vs = p->video;
+	int i = 0, j = 0;
+
+	for (i = 0; i < FF_ARRAY_ELEMS(sdl_texture_format_map); i++) {
+		if (sdl_texture_format_map[i].format != format)
+			continue;
+
+		Uint32 texture_fmt = sdl_texture_format_map[i].texture_fmt;
+
+		/* SDL can always do IYUV, in software if it has to */
+		if (texture_fmt == SDL_PIXELFORMAT_IYUV)
+			return texture_fmt;
+
+		for (j = 0; j < vs->sdlRendererInfo.num_texture_formats; j++) {
+			if (vs->sdlRendererInfo.texture_formats[j] == texture_fmt)
+				return texture_fmt;
+		}
+	}
+
+	return SDL_PIXELFORMAT_UNKNOWN;
+}
+
+static int init_filter_graph(Player *p, const char *filters_descr)
+{
+    VideoState *vs = p->video;
     char args[512];
     int ret = 0;
     AVFilter *buffersrc  = avfilter_get_by_name("buffer");
     AVFilter *buffersink = avfilter_get_by_name("buffersink");
     AVFilterInOut *outputs = avfilter_inout_alloc();
     AVFilterInOut *inputs  = avfilter_inout_alloc();
-    AVRational time_base = video_stream->time_base;
-    enum AVPixelFormat pix_fmts[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE };
+    AVRational time_base = vs->video_stream->time_base;
+    enum AVPixelFormat pix_fmts[FF_ARRAY_ELEMS(sdl_texture_format_map) + 1];
+    int i = 0, nb_pix_fmts = 0;
+
+    /* let the graph output whatever the renderer takes natively, so it only
+     * converts when the source format has no matching texture format */
+    for (i = 0; i < FF_ARRAY_ELEMS(sdl_texture_format_map); i++) {
+        if (sdl_texture_format(p, sdl_texture_format_map[i].format) != SDL_PIXELFORMAT_UNKNOWN)
+            pix_fmts[nb_pix_fmts++] = sdl_texture_format_map[i].format;
+    }
+    pix_fmts[nb_pix_fmts] = AV_PIX_FMT_NONE;
 
-    filter_graph = avfilter_graph_alloc();
-    if (!outputs || !inputs || !filter_graph) {
+    vs->filter_graph = avfilter_graph_alloc();
+    if (!outputs || !inputs || !vs->filter_graph) {
         ret = AVERROR(ENOMEM);
         goto end;
     }
@@ -54,25 +157,25 @@ int init_video_filters(const char *filters_descr)
     /* buffer video source: the decoded frames from the decoder will be inserted here. */
     snprintf(args, sizeof(args),
             "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
-            width, height, pix_fmt, time_base.num, time_base.den,
-            video_dec_ctx->sample_aspect_ratio.num, video_dec_ctx->sample_aspect_ratio.den);
+            vs->width, vs->height, vs->pix_fmt, time_base.num, time_base.den,
+            vs->video_dec_ctx->sample_aspect_ratio.num, vs->video_dec_ctx->sample_aspect_ratio.den);
 
-    ret = avfilter_graph_create_filter(&buffersrc_ctx, buffersrc, "in",
-                                       args, NULL, filter_graph);
+    ret = avfilter_graph_create_filter(&vs->buffersrc_ctx, buffersrc, "in",
+                                       args, NULL, vs->filter_graph);
     if (ret < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot create buffer source\n");
         goto end;
     }
 
     /* buffer video sink: to terminate the filter chain. */
-    ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out",
-                                       NULL, NULL, filter_graph);
+    ret = avfilter_graph_create_filter(&vs->buffersink_ctx, buffersink, "out",
+                                       NULL, NULL, vs->filter_graph);
     if (ret < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot create buffer sink\n");
         goto end;
     }
 
-    ret = av_opt_set_int_list(buffersink_ctx, "pix_fmts", pix_fmts,
+    ret = av_opt_set_int_list(vs->buffersink_ctx, "pix_fmts", pix_fmts,
                               AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN);
     if (ret < 0) {
         av_log(NULL, AV_LOG_ERROR, "Cannot set output pixel format\n");
@@ -91,7 +194,7 @@ int init_video_filters(const char *filters_descr)
      * default.
      */
     outputs->name       = av_strdup("in");
-    outputs->filter_ctx = buffersrc_ctx;
+    outputs->filter_ctx = vs->buffersrc_ctx;
     outputs->pad_idx    = 0;
     outputs->next       = NULL;
 
@@ -102,17 +205,19 @@ int init_video_filters(const char *filters_descr)
      * default.
      */
     inputs->name       = av_strdup("out");
-    inputs->filter_ctx = buffersink_ctx;
+    inputs->filter_ctx = vs->buffersink_ctx;
     inputs->pad_idx    = 0;
     inputs->next       = NULL;
 
-    if ((ret = avfilter_graph_parse_ptr(filter_graph, filters_descr,
+    if ((ret = avfilter_graph_parse_ptr(vs->filter_graph, filters_descr,
                                     &inputs, &outputs, NULL)) < 0)
         goto end;
 
-    if ((ret = avfilter_graph_config(filter_graph, NULL)) < 0)
+    if ((ret = avfilter_graph_config(vs->filter_graph, NULL)) < 0)
         goto end;
 
+    vs->filter_time_base = vs->buffersink_ctx->inputs[0]->time_base;
+
 end:
     avfilter_inout_free(&inputs);
     avfilter_inout_free(&outputs);
@@ -120,6 +225,32 @@ end:
     return ret;
 }
 
+/*
+ * Without a user filter the graph would only crop to even dimensions,
+ * which the texture rect does for free, so frames bypass libavfilter and
+ * go from the decoder to the texture without an extra copy.
+ */
+int init_video_filters(Player *p, const char *vf)
+{
+	VideoState *vs = p->video;
+
+	if (!vf) {
+		debug_info("no video filter, bypassing the filter graph\n");
+		return 0;
+	}
+
+	snprintf(vs->filter_descr, sizeof(vs->filter_descr), "crop=floor(in_w/2)*2:floor(in_h/2)*2,%s", vf);
+	return init_filter_graph(p, vs->filter_descr);
+}
+
+/* decoder side, what the frames coming out now count in */
+static AVRational video_frame_tb(Player *p)
+{
+	VideoState *vs = p->video;
+
+	return vs->filter_graph ? vs->filter_time_base : vs->video_stream->time_base;
+}
+
 static double get_stream_fps(const AVStream *s)
 {
 	AVRational a_fps = s->avg_frame_rate;
@@ -135,184 +266,861 @@ static double get_stream_fps(const AVStream *s)
 	return 25.0f;
 }
 
-static Uint32 video_proc(Uint32 interval, void *opaque)
-{  
-	int delta = 0;
-	int vt = 1000 / get_stream_fps(video_stream);
+/* presentation side, the graph may have been rebuilt since the frame was queued */
+static double frame_pts(Player *p, const AVFrame *frame)
+{
+	AVRational tb = frame_queue_time_base(&p->video->video_frameq, frame);
+	return (frame->pts == AV_NOPTS_VALUE || !tb.num) ? NAN : frame->pts * av_q2d(tb);
+}
+
+static double frame_duration(Player *p, double pts, double next_pts)
+{
+	double duration = next_pts - pts;
+	if (isnan(duration) || duration <= 0 || duration > AV_SYNC_MAX_FRAME_DURATION)
+		duration = 1.0 / get_stream_fps(p->video->video_stream);
+
+	return duration;
+}
+
+/* stretch or shrink the delay of the frame to follow the master clock */
+static double compute_target_delay(Player *p, double delay)
+{
+	double sync_threshold, diff = 0;
+
+	if (sync_master_type(p) != AV_SYNC_VIDEO_MASTER) {
+		diff = clock_get(sync_clock(p, AV_SYNC_VIDEO_MASTER)) - sync_get_master(p);
+
+		sync_threshold = FFMAX(AV_SYNC_THRESHOLD_MIN, FFMIN(AV_SYNC_THRESHOLD_MAX, delay));
+		if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD) {
+			if (diff <= -sync_threshold)
+				delay = FFMAX(0, delay + diff);
+			else if (diff >= sync_threshold && delay > AV_SYNC_FRAMEDUP_THRESHOLD)
+				delay = delay + diff;
+			else if (diff >= sync_threshold)
+				delay = 2 * delay;
+		}
+	}
+
+	return delay;
+}
+
+static int video_realloc_texture(Player *p, Uint32 format, int w, int h)
+{
+	VideoState *vs = p->video;
+	VideoTexture *t = NULL, *lru = &vs->textures[0];
+	int i = 0;
+
+	if (vs->sdlTexture && vs->sdlTextureFormat == format && vs->sdlRect.w == w && vs->sdlRect.h == h)
+		return 0;
+
+	for (i = 0; i < VIDEO_TEXTURE_CACHE && !t; i++) {
+		VideoTexture *c = &vs->textures[i];
+		if (c->texture && c->format == format && c->w == w && c->h == h)
+			t = c;
+		else if (lru->texture && (!c->texture || c->last_used < lru->last_used))
+			lru = c;
+	}
+
+	if (!t) {
+		t = lru;
+		if (t->texture)
+			SDL_DestroyTexture(t->texture);
+
+		t->texture = SDL_CreateTexture(vs->sdlRenderer, format, SDL_TEXTUREACCESS_STREAMING, w, h);
+		if (!t->texture) {
+			fprintf(stderr, "SDL: could not create texture - %s\n", SDL_GetError());
+			vs->sdlTexture = NULL;
+			return -1;
+		}
+		t->format = format;
+		t->w = w;
+		t->h = h;
+
+		debug_info("texture %dx%d format 0x%x\n", w, h, format);
+	}
+	t->last_used = ++vs->texture_uses;
+
+	/* the window keeps its size, the picture is scaled into it */
+	if (vs->sdlTexture && (vs->sdlRect.w != w || vs->sdlRect.h != h))
+		SDL_RenderSetLogicalSize(vs->sdlRenderer, w, h);
+
+	vs->sdlTexture = t->texture;
+	vs->sdlTextureFormat = format;
+	vs->sdlRect.x = 0;
+	vs->sdlRect.y = 0;
+	vs->sdlRect.w = w;
+	vs->sdlRect.h = h;
+
+	return 0;
+}
+
+/* convert straight into the locked texture, no intermediate frame */
+static int video_convert(Player *p, AVFrame *frame)
+{
+	VideoState *vs = p->video;
+	void *pixels = NULL;
+	int pitch = 0;
+	uint8_t *dst[4] = {NULL};
+	int dst_linesize[4] = {0};
+
+	vs->sws_ctx = sws_getCachedContext(vs->sws_ctx,
+		vs->sdlRect.w, vs->sdlRect.h, frame->format,
+		vs->sdlRect.w, vs->sdlRect.h, AV_PIX_FMT_YUV420P,
+		SWS_BILINEAR, NULL, NULL, NULL);
+	if (!vs->sws_ctx) {
+		fprintf(stderr, "Cannot initialize the conversion context\n");
+		return -1;
+	}
+
+	if (SDL_LockTexture(vs->sdlTexture, NULL, &pixels, &pitch) < 0) {
+		fprintf(stderr, "SDL: could not lock texture - %s\n", SDL_GetError());
+		return -1;
+	}
+
+	// IYUV: Y + U + V, chroma planes follow the luma one
+	dst[0] = pixels;
+	dst[1] = dst[0] + pitch * vs->sdlRect.h;
+	dst[2] = dst[1] + (pitch / 2) * (vs->sdlRect.h / 2);
+	dst_linesize[0] = pitch;
+	dst_linesize[1] = pitch / 2;
+	dst_linesize[2] = pitch / 2;
+
+	sws_scale(vs->sws_ctx, (const uint8_t * const *)frame->data, frame->linesize,
+		0, vs->sdlRect.h, dst, dst_linesize);
+
+	SDL_UnlockTexture(vs->sdlTexture);
+	return 0;
+}
+
+/* NV12/NV21: luma plane followed by the interleaved chroma plane */
+static int video_upload_nv(Player *p, AVFrame *frame)
+{
+	VideoState *vs = p->video;
+	void *pixels = NULL;
+	int pitch = 0;
+
+	if (SDL_LockTexture(vs->sdlTexture, NULL, &pixels, &pitch) < 0) {
+		fprintf(stderr, "SDL: could not lock texture - %s\n", SDL_GetError());
+		return -1;
+	}
+
+	av_image_copy_plane(pixels, pitch, frame->data[0], frame->linesize[0],
+		vs->sdlRect.w, vs->sdlRect.h);
+	av_image_copy_plane((uint8_t *)pixels + pitch * vs->sdlRect.h, pitch,
+		frame->data[1], frame->linesize[1], vs->sdlRect.w, vs->sdlRect.h / 2);
+
+	SDL_UnlockTexture(vs->sdlTexture);
+	return 0;
+}
+
+static int video_upload(Player *p, AVFrame *frame)
+{
+	VideoState *vs = p->video;
+	Uint32 format = sdl_texture_format(p, frame->format);
+
+	/* sdlRect is even sized, which crops odd frames for free */
+	if (format == SDL_PIXELFORMAT_UNKNOWN) {
+		if (video_realloc_texture(p, SDL_PIXELFORMAT_IYUV, frame->width & ~1, frame->height & ~1) < 0)
+			return -1;
+		return video_convert(p, frame);
+	}
+
+	if (video_realloc_texture(p, format, frame->width & ~1, frame->height & ~1) < 0)
+		return -1;
+
+	switch (format) {
+	case SDL_PIXELFORMAT_IYUV:
+		return SDL_UpdateYUVTexture(vs->sdlTexture, &vs->sdlRect,
+			frame->data[0], frame->linesize[0],
+			frame->data[1], frame->linesize[1],
+			frame->data[2], frame->linesize[2]);
+	case SDL_PIXELFORMAT_NV12:
+	case SDL_PIXELFORMAT_NV21:
+		return video_upload_nv(p, frame);
+	default:
+		return SDL_UpdateTexture(vs->sdlTexture, &vs->sdlRect, frame->data[0], frame->linesize[0]);
+	}
+}
+
+static void video_display(Player *p, AVFrame *frame)
+{
+	VideoState *vs = p->video;
+	int64_t begin = 0;
+	int ret = 0;
+
+	/* embedded without a window, the application draws it */
+	if (p->opts.video_cb) {
+		begin = stats_begin();
+		p->opts.video_cb(p->opts.opaque, frame, frame_pts(p, frame));
+		stats_end(p, STATS_VIDEO_PRESENT, begin);
+		stats_add_frames(p, STATS_VIDEO_PRESENT, 1);
+		stats_first_frame(p);
+		return;
+	}
+
+	begin = stats_begin();
+	ret = video_upload(p, frame);
+	stats_end(p, STATS_VIDEO_UPLOAD, begin);
+	if (ret < 0) {
+		return;
+	}
+
+	begin = stats_begin();
+	SDL_RenderClear(vs->sdlRenderer);
+	SDL_RenderCopy(vs->sdlRenderer, vs->sdlTexture,  NULL, &vs->sdlRect);
+	subtitle_render(p, vs->sdlRenderer, &vs->sdlRect, frame_pts(p, frame));
+	stats_draw_overlay(p, vs->sdlRenderer, vs->sdlRect.w, vs->sdlRect.h);
+	SDL_RenderPresent(vs->sdlRenderer);
+	stats_end(p, STATS_VIDEO_PRESENT, begin);
+	stats_add_frames(p, STATS_VIDEO_PRESENT, 1);
+	stats_first_frame(p);
+}
+
+/*
+ * Present the frame that is due, on the thread that owns the renderer.
+ * Returns how many ms the caller may sleep before the next frame is due,
+ * 0 to be called again right away, -1 to wait for USR_VIDEO_EVENT.
+ */
+int video_refresh(Player *p)
+{
+	VideoState *vs = p->video;
+	double time, delay, pts;
+	int serial = 0;
+	AVFrame *frame = NULL, *next = NULL;
+
+	if (!vs->video_running) {
+		return -1;
+	}
+
+retry:
+	// pick a decoded frame, paint it when it is due
+	frame = frame_queue_peek(&vs->video_frameq);
+	if (!frame) {
+		return -1;
+	}
+
+	// decoded before a seek, skip it
+	serial = frame_queue_peek_serial(&vs->video_frameq);
+	if (serial != packet_queue_serial(&vs->video_queue)) {
+		frame_queue_next(&vs->video_frameq);
+		goto retry;
+	}
+
+	// first frame after a seek, restart the schedule from it
+	if (serial != vs->frame_last_serial) {
+		vs->frame_timer = 0;
+		vs->frame_last_pts = NAN;
+		vs->frame_last_serial = serial;
+	}
+
+	pts = frame_pts(p, frame);
+	delay = compute_target_delay(p, frame_duration(p, vs->frame_last_pts, pts) / vs->video_speed);
+
+	time = clock_time();
+	if (!vs->frame_timer) {
+		vs->frame_timer = time;
+	}
+	if (time < vs->frame_timer + delay) {
+		// round down, we spin for the last fraction of a ms
+		return (vs->frame_timer + delay - time) * 1000;
+	}
+
+	vs->frame_timer += delay;
+	if (delay > 0 && time - vs->frame_timer > AV_SYNC_THRESHOLD_MAX) {
+		vs->frame_timer = time;
+	}
+
+	vs->frame_last_pts = pts;
+	if (!isnan(pts)) {
+		clock_set(sync_clock(p, AV_SYNC_VIDEO_MASTER), pts);
+		clock_sync_to_slave(sync_clock(p, AV_SYNC_EXTERNAL_CLOCK), sync_clock(p, AV_SYNC_VIDEO_MASTER));
+	}
+
+	// we are late, skip this frame if the next one is due already
+	next = frame_queue_peek_next(&vs->video_frameq);
+	if (next && vs->framedrop && sync_master_type(p) != AV_SYNC_VIDEO_MASTER &&
+		time > vs->frame_timer + frame_duration(p, pts, frame_pts(p, next)) / vs->video_speed) {
+		stats_count(p, STATS_VIDEO_DROPS_LATE);
+		debug_info("video frame dropped late, early:%d late:%d\n",
+			stats_counter(p, STATS_VIDEO_DROPS_EARLY), stats_counter(p, STATS_VIDEO_DROPS_LATE));
+		frame_queue_next(&vs->video_frameq);
+		goto retry;
+	}
+
+	/* once per frame on the screen, not per wakeup */
+	if (sync_master_type(p) != AV_SYNC_VIDEO_MASTER)
+		stats_drift(p, pts - sync_get_master(p));
+	video_display(p, frame);
+	frame_queue_next(&vs->video_frameq);
+
+	// come back right away to work out when the next one is due
+	return 0;
+}
+
+/* wake up the presentation loop, it waits for events when it has no frame */
+static void video_notify(Player *p)
+{
+	SDL_Event event;
+
+	if (!bench_enabled(p) && frame_queue_nb_frames(&p->video->video_frameq) == 1) {
+		memset(&event, 0, sizeof(event));
+		event.type = USR_VIDEO_EVENT;
+		event.user.data1 = p;
+		SDL_PushEvent(&event);
+	}
+}
+
+/* move what the graph has into the frame queue, what does not fit stays in the graph */
+static int video_drain_filters(Player *p)
+{
+	VideoState *vs = p->video;
+	int64_t begin = 0;
+	int ret = 0;
+
+	vs->filter_pending = 0;
+
+	while (1) {
+		AVFrame *vp = frame_queue_peek_writable(&vs->video_frameq, 0);
+		if (!vp) {
+			vs->filter_pending = 1;
+			return 0;
+		}
+
+		begin = stats_begin();
+		ret = av_buffersink_get_frame(vs->buffersink_ctx, vp);
+		stats_end(p, STATS_VIDEO_FILTER, begin);
+		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+			return 0;
+		if (ret < 0)
+			return ret;
+
+		stats_add_frames(p, STATS_VIDEO_FILTER, 1);
+		frame_queue_push(&vs->video_frameq, vs->video_serial, vs->filter_time_base);
+		video_notify(p);
+	}
+}
+
+/*
+ * The decoder switched size or pixel format (ABR, concatenated files): the
+ * graph is rebuilt for the new input and the display picks the texture up
+ * from the frame, so this costs the frames held in the graph, no more.
+ */
+static int video_reconfigure(Player *p, const AVFrame *frame)
+{
+	VideoState *vs = p->video;
+
+	debug_info("video changed from %dx%d %s to %dx%d %s\n",
+		vs->width, vs->height, av_get_pix_fmt_name(vs->pix_fmt),
+		frame->width, frame->height, av_get_pix_fmt_name(frame->format));
 
-	// read from video_queue and paint
+	vs->width = frame->width;
+	vs->height = frame->height;
+	vs->pix_fmt = frame->format;
+
+	if (vs->filter_graph) {
+		avfilter_graph_free(&vs->filter_graph);
+		vs->filter_pending = 0;
+		if (init_filter_graph(p, vs->filter_descr) < 0) {
+			fprintf(stderr, "Could not reconfigure the video filters for %dx%d %s\n",
+				frame->width, frame->height, av_get_pix_fmt_name(frame->format));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* the packets now come from somewhere else, forget everything decoded so far */
+static void video_decoder_flush(Player *p, int serial)
+{
+	VideoState *vs = p->video;
+
+	avcodec_flush_buffers(vs->video_dec_ctx);
+
+	/* the graph may still hold frames from before the seek */
+	if (vs->filter_graph) {
+		avfilter_graph_free(&vs->filter_graph);
+		if (init_filter_graph(p, vs->filter_descr) < 0)
+			fprintf(stderr, "Could not reinitialize the video filters\n");
+	}
+
+	vs->video_serial = serial;
+	vs->video_seek_target = vs->video_flush_target;
+}
+
+static int decode_video(Player *p, AVPacket *pkt, int *got_frame);
+
+/*
+ * Decode ahead of presentation until the frame queue is full, one packet
+ * or one delayed frame per step. There is room for the frame before the
+ * packet is taken, so a step never waits on the presentation side.
+ */
+static int video_decode_step(void *opaque)
+{
+	Player *p = opaque;
+	VideoState *vs = p->video;
 	AVPacket video_pkt;
-	if (video_dequeue(&video_pkt)) {
-		decode_video_packet(&video_pkt);
+	int serial = 0, got_frame = 0;
 
-		int v_pts = get_video_pts();
-		int a_pts = get_audio_pts();
-		if ((v_pts > 0) && (a_pts > 0)) {
-			delta = v_pts - a_pts;
+	if (packet_queue_aborted(&vs->video_queue))
+		return TASK_DONE;
+
+	if (!frame_queue_peek_writable(&vs->video_frameq, 0))
+		return TASK_WAIT;
+
+	/* seeked away, what was left of the old packets is stale */
+	if (packet_queue_serial(&vs->video_queue) != vs->video_serial)
+		vs->filter_pending = vs->video_draining = vs->video_finishing = 0;
+
+	if (vs->filter_pending) {
+		video_drain_filters(p);
+		return TASK_AGAIN;
+	}
+
+	if (vs->video_finishing) {
+		vs->video_finishing = 0;
+		vs->video_finished = vs->video_serial;
+	}
+
+	if (vs->video_draining) {
+		/* end of file, get the delayed frames out of the decoder */
+		av_init_packet(&video_pkt);
+		video_pkt.data = NULL;
+		video_pkt.size = 0;
+		video_pkt.stream_index = vs->video_stream_idx;
+		if (decode_video(p, &video_pkt, &got_frame) < 0 || !got_frame) {
+			vs->video_draining = 0;
+			/* and the frames the filters still hold, fps and yadif keep some */
+			if (vs->filter_graph && av_buffersrc_add_frame(vs->buffersrc_ctx, NULL) >= 0)
+				video_drain_filters(p);
+			vs->video_finishing = 1;
 		}
+		return TASK_AGAIN;
 	}
 
-	return (vt + delta > 0) ? (vt + delta) : 1;
+	if (!packet_queue_get(&vs->video_queue, &video_pkt, 0, &serial))
+		return TASK_WAIT;
+
+	if (serial != vs->video_serial)
+		video_decoder_flush(p, serial);
+
+	/* the decoder reads it with every packet, frame threads included */
+	vs->video_dec_ctx->skip_frame = SDL_AtomicGet(&vs->video_skip_nonref) ?
+		AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+
+	if (!video_pkt.data) {
+		vs->video_draining = 1;
+		return TASK_AGAIN;
+	}
+
+	decode_video(p, &video_pkt, &got_frame);
+	av_packet_unref(&video_pkt);
+
+	return TASK_AGAIN;
+}
+
+int decode_video_packet(Player *p, AVPacket *pkt)
+{
+	int got_frame = 0;
+
+	return decode_video(p, pkt, &got_frame);
 }
 
-int decode_video_packet(AVPacket *pkt)
+static int decode_video(Player *p, AVPacket *pkt, int *got_frame)
 {
+    VideoState *vs = p->video;
     int ret = 0;
     int decoded = pkt->size;
+    int64_t begin = 0;
 
-    int _got_frame = 0, *got_frame = &_got_frame;
+    *got_frame = 0;
 
-    if (pkt->stream_index == video_stream_idx) {
+    if (pkt->stream_index == vs->video_stream_idx) {
         /* decode video frame */
-        ret = avcodec_decode_video2(video_dec_ctx, frame_video, got_frame, pkt);
+        begin = stats_begin();
+        ret = avcodec_decode_video2(vs->video_dec_ctx, vs->frame_video, got_frame, pkt);
+        stats_end(p, STATS_VIDEO_DECODE, begin);
         if (ret < 0) {
             fprintf(stderr, "Error decoding video frame (%s)\n", av_err2str(ret));
             return ret;
         }
 
         if (*got_frame) {
-            if (frame_video->width != width || frame_video->height != height ||
-                frame_video->format != pix_fmt) {
-                /* To handle this change, one could call av_image_alloc again and
-                 * decode the following frames into another rawvideo file. */
-                fprintf(stderr, "Error: Width, height and pixel format have to be "
-                        "constant in a rawvideo file, but the width, height or "
-                        "pixel format of the input video changed:\n"
-                        "old: width = %d, height = %d, format = %s\n"
-                        "new: width = %d, height = %d, format = %s\n",
-                        width, height, av_get_pix_fmt_name(pix_fmt),
-                        frame_video->width, frame_video->height,
-                        av_get_pix_fmt_name(frame_video->format));
-                return -1;
+            stats_add_frames(p, STATS_VIDEO_DECODE, 1);
+
+            if (vs->frame_video->width != vs->width || vs->frame_video->height != vs->height ||
+                vs->frame_video->format != vs->pix_fmt) {
+                if (video_reconfigure(p, vs->frame_video) < 0) {
+                    av_frame_unref(vs->frame_video);
+                    *got_frame = 0;
+                    return AVERROR(EINVAL);
+                }
             }
 
             debug_info("video_frame n:%d coded_n:%d pts:%d\n",
-                   video_frame_count++, frame_video->coded_picture_number,
-                   get_video_pts());
+                   vs->video_frame_count++, vs->frame_video->coded_picture_number,
+                   get_video_pts(p));
 
 		// IMPORTANT!!! fix pts !!!
-		frame_video->pts = av_frame_get_best_effort_timestamp(frame_video);
+		vs->frame_video->pts = av_frame_get_best_effort_timestamp(vs->frame_video);
 		// IMPORTANT!!! fix pts !!!
 
+		/* decode from the keyframe up to the seek target without showing anything */
+		if (!isnan(vs->video_seek_target)) {
+			if (vs->frame_video->pts != AV_NOPTS_VALUE &&
+				vs->frame_video->pts * av_q2d(vs->video_stream->time_base) + 1.0 / get_stream_fps(vs->video_stream) <= vs->video_seek_target) {
+				av_frame_unref(vs->frame_video);
+				return decoded;
+			}
+			vs->video_seek_target = NAN;
+		}
+
+		/* too late already, drop it before it costs us filtering and rendering */
+		if (vs->framedrop && sync_master_type(p) != AV_SYNC_VIDEO_MASTER &&
+			vs->frame_video->pts != AV_NOPTS_VALUE) {
+			double diff = vs->frame_video->pts * av_q2d(vs->video_stream->time_base) - sync_get_master(p);
+			if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD && diff < 0 &&
+				packet_queue_nb_packets(&vs->video_queue)) {
+				stats_count(p, STATS_VIDEO_DROPS_EARLY);
+				debug_info("video frame dropped early, early:%d late:%d\n",
+					stats_counter(p, STATS_VIDEO_DROPS_EARLY), stats_counter(p, STATS_VIDEO_DROPS_LATE));
+				av_frame_unref(vs->frame_video);
+				return decoded;
+			}
+		}
+
+		if (!vs->filter_graph) {
+			AVFrame *vp = frame_queue_peek_writable(&vs->video_frameq, 0);
+			if (!vp)
+				return AVERROR_EXIT;
+
+			/* only moves the reference, the decoded picture is uploaded as is */
+			av_frame_move_ref(vp, vs->frame_video);
+			frame_queue_push(&vs->video_frameq, vs->video_serial, vs->video_stream->time_base);
+			video_notify(p);
+			return decoded;
+		}
+
 		/* push the decoded frame into the filtergraph */
-		ret = av_buffersrc_add_frame(buffersrc_ctx, frame_video);
+		begin = stats_begin();
+		ret = av_buffersrc_add_frame(vs->buffersrc_ctx, vs->frame_video);
+		stats_end(p, STATS_VIDEO_FILTER, begin);
 		if (ret < 0) {
 			av_log(NULL, AV_LOG_ERROR, "Error while feeding the filtergraph\n");
 			return ret;
 		}
 		
 		/* pull filtered frames from the filtergraph */
-		while (1) {
-			ret = av_buffersink_get_frame(buffersink_ctx, frame_video);
-			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-				break;
-			if (ret < 0)
-				return ret;
-			
-			SDL_UpdateYUVTexture(sdlTexture, &sdlRect,	
-			frame_video->data[0], frame_video->linesize[0],  
-			frame_video->data[1], frame_video->linesize[1],  
-			frame_video->data[2], frame_video->linesize[2]);
-			
-			SDL_RenderClear(sdlRenderer);	 
-			SDL_RenderCopy(sdlRenderer, sdlTexture,  NULL, &sdlRect);	  
-			SDL_RenderPresent(sdlRenderer); 
-
-			av_frame_unref(frame_video);
-		}
+		if ((ret = video_drain_filters(p)) < 0)
+			return ret;
         }
     }
 
     return decoded;
 }
 
-int open_video_codec(AVFormatContext *fmt_ctx)
+/* allocates p->video, close_video_codec frees it even if this fails */
+int open_video_codec(Player *p)
 {
-	int ret = open_codec_context(&video_stream_idx, fmt_ctx, AVMEDIA_TYPE_VIDEO);
-	if (ret >= 0) {
-		packet_queue_init(&video_queue);
+	VideoState *vs = p->video = av_mallocz(sizeof(VideoState));
+	if (!vs)
+		return AVERROR(ENOMEM);
 
-		frame_video = av_frame_alloc();
-		if (!frame_video) {
+	vs->framedrop = p->opts.framedrop;
+	vs->bench_upload = p->opts.bench_upload;
+	vs->frame_last_pts = NAN;
+	vs->video_flush_target = NAN;
+	vs->video_seek_target = NAN;
+	vs->video_finished = -1;
+	vs->video_speed = 1.0;
+	vs->pix_fmt = AV_PIX_FMT_NONE;
+	vs->sdlTextureFormat = SDL_PIXELFORMAT_UNKNOWN;
+
+	int ret = open_codec_context(p, &vs->video_stream_idx, AVMEDIA_TYPE_VIDEO);
+	if (ret >= 0) {
+		vs->frame_video = av_frame_alloc();
+		if (!vs->frame_video) {
 			fprintf(stderr, "Could not allocate frame\n");
 			return AVERROR(ENOMEM);
 		}
 		
-		video_stream = fmt_ctx->streams[video_stream_idx];
-		video_dec_ctx = video_stream->codec;
+		vs->video_stream = p->fmt_ctx->streams[vs->video_stream_idx];
+		vs->video_dec_ctx = vs->video_stream->codec;
+
+		if ((ret = packet_queue_init(&vs->video_queue, vs->video_stream->time_base,
+			p->opts.max_queue_size, p->opts.max_queue_time)) < 0) {
+			fprintf(stderr, "Could not allocate packet queue\n");
+			return ret;
+		}
+		stats_register_queue(p, "video", &vs->video_queue);
+
+		/* frame threaded decoders deliver in bursts, give them some room */
+		int nb_frames = (vs->video_dec_ctx->active_thread_type & FF_THREAD_FRAME) ? 6 : 3;
+		if ((ret = frame_queue_init(&vs->video_frameq, nb_frames)) < 0) {
+			fprintf(stderr, "Could not allocate frame queue\n");
+			return ret;
+		}
 
-		width = video_dec_ctx->width;
-		height = video_dec_ctx->height;
-		pix_fmt = video_dec_ctx->pix_fmt;
+		vs->width = vs->video_dec_ctx->width;
+		vs->height = vs->video_dec_ctx->height;
+		vs->pix_fmt = vs->video_dec_ctx->pix_fmt;
+
+		vs->video_task = task_create("video_decode", video_decode_step, p);
+		if (!vs->video_task)
+			return AVERROR(ENOMEM);
+		vs->video_queue.producer = p->demux_task;
+		vs->video_queue.consumer = vs->video_task;
+		vs->video_frameq.producer = vs->video_task;
 	}
 	
 	return ret;
 }
 
-int close_video_codec(void)
+int close_video_codec(Player *p)
 {
-	av_frame_free(&frame_video);
-	avcodec_close(video_dec_ctx);
+	VideoState *vs = p->video;
+	int i = 0;
+
+	if (!vs)
+		return 0;
+
+	/* it stops on the aborted queue, even if it never ran */
+	if (vs->video_task)
+		packet_queue_abort(&vs->video_queue);
+	task_join(vs->video_task);
+	task_free(&vs->video_task);
+
+	frame_queue_destroy(&vs->video_frameq);
+	packet_queue_destroy(&vs->video_queue);
+	avfilter_graph_free(&vs->filter_graph);
+	sws_freeContext(vs->sws_ctx);
+	vs->sws_ctx = NULL;
+	av_frame_free(&vs->frame_video);
+	avcodec_close(vs->video_dec_ctx);
+
+	for (i = 0; i < VIDEO_TEXTURE_CACHE; i++)
+		if (vs->textures[i].texture)
+			SDL_DestroyTexture(vs->textures[i].texture);
+	if (vs->sdlRenderer)
+		SDL_DestroyRenderer(vs->sdlRenderer);
+	if (vs->sdlWindow)
+		SDL_DestroyWindow(vs->sdlWindow);
+
+	av_freep(&p->video);
+	return 0;
 }
 
-int sdl_video_init(void)
+int sdl_video_init(Player *p)
 {
-	//SDL 2.0 Support for multiple windows	
-	SDL_Window *screen = SDL_CreateWindow(PACKAGE_NAME,
-		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,  width, height,  
-		SDL_WINDOW_OPENGL);  
+	VideoState *vs = p->video;
+
+	/* the application gets the frames, there is nothing for us to draw on */
+	if (p->opts.video_cb)
+		return 0;
 
-	if(!screen) {	 
+	//SDL 2.0 Support for multiple windows, one per player
+	//the benchmark renders offscreen, with whatever the driver has
+	vs->sdlWindow = SDL_CreateWindow(PACKAGE_NAME,
+		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,  vs->width, vs->height,  
+		bench_enabled(p) ? SDL_WINDOW_HIDDEN : SDL_WINDOW_OPENGL);  
+
+	if(!vs->sdlWindow) {	 
 		fprintf(stderr, "SDL: could not create window - exiting:%s\n",SDL_GetError());	  
 		return 1;	
 	}  
 
-	sdlRenderer = SDL_CreateRenderer(screen, -1, 0);	
+	vs->sdlRenderer = SDL_CreateRenderer(vs->sdlWindow, -1, 0);	
 
-	//IYUV: Y + U + V  (3 planes)  
-	//YV12: Y + V + U  (3 planes)  
-	sdlTexture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING,width,height);
+	/* the texture is created on the first frame, once we know what the
+	 * decoder or the filter graph hands us and what the renderer takes */
+	if (SDL_GetRendererInfo(vs->sdlRenderer, &vs->sdlRendererInfo) < 0) {
+		fprintf(stderr, "SDL: could not get renderer info - %s\n", SDL_GetError());
+		memset(&vs->sdlRendererInfo, 0, sizeof(vs->sdlRendererInfo));
+	}
 
-	sdlRect.x = 0;
-	sdlRect.y = 0;	
-	sdlRect.w = width;	
-	sdlRect.h = height;
+	debug_info("renderer %s, %d texture formats\n",
+		vs->sdlRendererInfo.name, vs->sdlRendererInfo.num_texture_formats);
 
 	return 0;
 }
 
-/* inline */ int is_video_packet(const AVPacket *pkt)
+/* inline */ int video_get_stream(Player *p)
 {
-	return (pkt->stream_index == video_stream_idx);
+	return p->video->video_stream_idx;
+}
+
+/* inline */ int is_video_packet(Player *p, const AVPacket *pkt)
+{
+	return (pkt->stream_index == p->video->video_stream_idx);
+}
+
+/* inline */ int video_enqueue(Player *p, const AVPacket *pkt)
+{
+	return packet_queue_put(&p->video->video_queue, pkt, 0);
+}
+
+/* demuxer only: adds what is queued to *size, a cover picture has enough with itself */
+/* inline */ int video_queue_enough(Player *p, int *size)
+{
+	VideoState *vs = p->video;
+
+	*size += packet_queue_size(&vs->video_queue);
+	return (vs->video_stream->disposition & AV_DISPOSITION_ATTACHED_PIC) ||
+		packet_queue_enough(&vs->video_queue);
 }
 
-/* inline */ int video_enqueue(const AVPacket *pkt)
+/* inline */ int video_dequeue(Player *p, AVPacket *pkt)
 {
-	return packet_queue_put(&video_queue, pkt);
+	return packet_queue_get(&p->video->video_queue, pkt, 1, NULL);
 }
 
-/* inline */ int video_dequeue(AVPacket *pkt)
+/* inline */ void video_abort(Player *p)
 {
-	return packet_queue_get(&video_queue, pkt);
+	VideoState *vs = p->video;
+
+	packet_queue_abort(&vs->video_queue);
+	frame_queue_abort(&vs->video_frameq);
+}
+
+/* inline */ void video_interrupt(Player *p)
+{
+	packet_queue_interrupt(&p->video->video_queue);
+}
+
+/* demuxer only, right after a seek to target */
+/* inline */ void video_flush(Player *p, double target)
+{
+	VideoState *vs = p->video;
+
+	vs->video_flush_target = target;
+	packet_queue_flush(&vs->video_queue);
+}
+
+/* demuxer only, queue an empty packet to drain the decoder, EAGAIN while the queue is full */
+/* inline */ int video_eof(Player *p)
+{
+	VideoState *vs = p->video;
+	AVPacket pkt;
+
+	av_init_packet(&pkt);
+	pkt.data = NULL;
+	pkt.size = 0;
+	pkt.stream_index = vs->video_stream_idx;
+	return packet_queue_put(&vs->video_queue, &pkt, 0);
+}
+
+/* --bench and --output: take the next decoded frame as soon as it is there, returns 0 if there was none */
+int video_bench_step(Player *p)
+{
+	VideoState *vs = p->video;
+	AVFrame *frame = frame_queue_peek(&vs->video_frameq);
+	if (!frame)
+		return 0;
+
+	if (vs->bench_upload && vs->sdlRenderer) {
+		int64_t begin = stats_begin();
+		video_upload(p, frame);
+		stats_end(p, STATS_VIDEO_UPLOAD, begin);
+		stats_add_frames(p, STATS_VIDEO_UPLOAD, 1);
+	}
+
+	if (export_enabled(p))
+		export_video_frame(p, frame, frame_queue_time_base(&vs->video_frameq, frame));
+	stats_first_frame(p);
+
+	frame_queue_next(&vs->video_frameq);
+	return 1;
+}
+
+/* what the frames handed out of the frame queue look like, -1 without video */
+int video_get_output(Player *p, int *w, int *h, enum AVPixelFormat *format, AVRational *sar,
+	AVRational *time_base, AVRational *frame_rate)
+{
+	VideoState *vs = p->video;
+
+	if (!vs)
+		return -1;
+
+	if (vs->filter_graph) {
+		AVFilterLink *link = vs->buffersink_ctx->inputs[0];
+		*w = link->w;
+		*h = link->h;
+		*format = link->format;
+		*sar = link->sample_aspect_ratio;
+		*frame_rate = link->frame_rate;
+	} else {
+		*w = vs->width;
+		*h = vs->height;
+		*format = vs->pix_fmt;
+		*sar = vs->video_dec_ctx->sample_aspect_ratio;
+		*frame_rate = (AVRational){ 0, 1 };
+	}
+
+	if (!frame_rate->num || !frame_rate->den)
+		*frame_rate = av_d2q(get_stream_fps(vs->video_stream), 100000);
+	*time_base = video_frame_tb(p);
+
+	return 0;
+}
+
+/* inline */ int video_bench_done(Player *p)
+{
+	VideoState *vs = p->video;
+
+	return vs->video_finished == packet_queue_serial(&vs->video_queue) &&
+		!frame_queue_nb_frames(&vs->video_frameq);
+}
+
+/* the schedule follows the clocks at speed, see sync_set_speed */
+/* inline */ void video_set_speed(Player *p, double speed)
+{
+	VideoState *vs = p->video;
+
+	vs->video_speed = speed;
+	SDL_AtomicSet(&vs->video_skip_nonref, speed > 1.0);
+}
+
+/* live catch-up: the schedule follows the clocks, but every frame is still decoded */
+/* inline */ void video_set_rate(Player *p, double rate)
+{
+	p->video->video_speed = rate;
+}
+
+/* inline */ void video_start(Player *p)
+{
+	VideoState *vs = p->video;
+
+	task_wake(vs->video_task);
+
+	/* resuming from pause, push the schedule back by the time we were paused */
+	if (vs->frame_timer) {
+		Clock *vidclk = sync_clock(p, AV_SYNC_VIDEO_MASTER);
+		vs->frame_timer += clock_time() - vidclk->last_updated;
+		clock_set(vidclk, clock_get(vidclk));
+	}
+
+	/* presented from the event loop, see video_refresh; the benchmark
+	 * pulls frames itself, see video_bench_step */
+	vs->video_running = 1;
 }
 
-/* inline */ void video_start()
+/* inline */ int video_wait_ready(Player *p, int timeout)
 {
-	videoTimerId = SDL_AddTimer(1, video_proc, NULL);
+	return frame_queue_wait_ready(&p->video->video_frameq, timeout);
 }
 
-/* inline */ void video_stop()
+/* inline */ void video_stop(Player *p)
 {
-	SDL_RemoveTimer(videoTimerId);
+	p->video->video_running = 0;
 }
 
-/* inline */ int get_video_pts()
+/* inline */ int get_video_pts(Player *p)
 {
-	int64_t pts = frame_video ? av_frame_get_best_effort_timestamp(frame_video) : AV_NOPTS_VALUE;
-	if (pts == AV_NOPTS_VALUE) {
+	double pts = clock_get(sync_clock(p, AV_SYNC_VIDEO_MASTER));
+	if (isnan(pts)) {
 		return -1;
 	} else {
-		return av_rescale_q(pts, video_stream->time_base, (AVRational){1, 1000});
+		return pts * 1000;
 	}
 }
 
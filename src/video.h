@@ -1,19 +1,36 @@
 #ifndef __VIDEO_H__
 #define __VIDEO_H__
 
-int sdl_video_init(void);
+int sdl_video_init(Player *p);
+int init_video_filters(Player *p, const char *vf);
 
-int open_video_codec(AVFormatContext *fmt_ctx);
-int close_video_codec(void);
-int decode_video_packet(AVPacket *pkt);
+int open_video_codec(Player *p);
+int close_video_codec(Player *p);
+int decode_video_packet(Player *p, AVPacket *pkt);
 
-int is_video_packet(const AVPacket *pkt);
-int video_enqueue(const AVPacket *pkt);
-int video_dequeue(AVPacket *pkt);
+int is_video_packet(Player *p, const AVPacket *pkt);
+int video_get_stream(Player *p);
+int video_enqueue(Player *p, const AVPacket *pkt);
+int video_queue_enough(Player *p, int *size);
+int video_dequeue(Player *p, AVPacket *pkt);
 
-void video_start();
-void video_stop();
+void video_abort(Player *p);
+void video_interrupt(Player *p);
+void video_flush(Player *p, double target);
+int video_eof(Player *p);
+void video_set_speed(Player *p, double speed);
+void video_set_rate(Player *p, double rate);
+void video_start(Player *p);
+void video_stop(Player *p);
+int video_wait_ready(Player *p, int timeout);
+int video_refresh(Player *p);
 
-int get_video_pts();
+int video_bench_step(Player *p);
+int video_bench_done(Player *p);
+
+int video_get_output(Player *p, int *w, int *h, enum AVPixelFormat *format, AVRational *sar,
+	AVRational *time_base, AVRational *frame_rate);
+
+int get_video_pts(Player *p);
 
 #endif